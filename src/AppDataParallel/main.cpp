@@ -0,0 +1,120 @@
+﻿#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+#include "NeuralNetwork.hpp"
+#include "NeuralNetworkTrainer.hpp"
+#include "DataParallelTrainer.hpp"
+
+/**
+ * Обучение нейронной сети несколькими процессами.
+ * Сравнивает пропускную способность обучения несколькими процессами
+ * с обучением в одном процессе обычным обучателем.
+ */
+
+// Количество входов
+const std::size_t inputs = 64;
+// Количество нейронов скрытого слоя
+const std::size_t hidden = 128;
+// Количество выходов
+const std::size_t outputs = 10;
+// Количество обучающих примеров
+const std::size_t examples = 2000;
+// Общее количество шагов обучения
+const std::size_t samples = 100000;
+// Скорость обучения
+const double learningRate = 0.1;
+//
+const double momentum = 0.5;
+// Количество шагов обучения каждого процесса между обменами весами
+const std::size_t syncInterval = 100;
+
+/**
+ * Создание сети со случайными весами.
+ *
+ * \param rng Генератор случайных чисел
+ * \return Нейронная сеть
+ */
+NN::NeuralNetwork MakeNetwork(std::mt19937& rng)
+{
+    NN::NeuralNetwork nn(inputs, {
+        { hidden, NN::ActivationFunction::Sigmoid, 1.0 },
+        { outputs, NN::ActivationFunction::Sigmoid, 1.0 }
+    });
+    NN::NeuralNetworkTrainer(nn, learningRate, momentum).Init(-0.5, 0.5, rng);
+    return nn;
+}
+
+/**
+ * Вычисление среднеквадратичной ошибки на всех обучающих примерах.
+ */
+double Evaluate(const NN::NeuralNetwork& nn, const std::vector<NN::Vector>& X, const std::vector<NN::Vector>& Y)
+{
+    double error = 0.0;
+    for (std::size_t i = 0; i < X.size(); i++) {
+        const NN::Vector difference = nn.Forward(X[i]) - Y[i];
+        error += (difference ^ difference) / difference.Size();
+    }
+    return error / X.size();
+}
+
+// Использование: AppDataParallel [максимальное количество процессов]
+int main (int argc, char *argv[]){
+    const std::size_t maxWorkers = argc > 1
+        ? std::strtoul(argv[1], nullptr, 10)
+        : std::max<std::size_t>(4, std::thread::hardware_concurrency());
+    std::mt19937 rng(1);
+    // Обучающие данные: выходы "учителя" - сети со случайными весами
+    NN::NeuralNetwork teacher = MakeNetwork(rng);
+    std::uniform_real_distribution<double> ds(0.0, 1.0);
+    std::vector<NN::Vector> X, Y;
+    for (std::size_t i = 0; i < examples; i++) {
+        NN::Vector x(inputs);
+        for (std::size_t j = 0; j < inputs; j++) {
+            x[j] = ds(rng);
+        }
+        X.push_back(x);
+        Y.push_back(teacher.Forward(x));
+    }
+    // Начальные веса одинаковы во всех запусках
+    const NN::NeuralNetwork initial = MakeNetwork(rng);
+    std::cout << "Processors: " << std::thread::hardware_concurrency()
+              << ", initial error: " << Evaluate(initial, X, Y) << "\n\n";
+
+    // Обучение в одном процессе
+    NN::NeuralNetwork single = initial;
+    NN::NeuralNetworkTrainer trainer(single, learningRate, momentum);
+    std::uniform_int_distribution<std::size_t> index(0, examples - 1);
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t step = 0; step < samples; step++) {
+        const std::size_t i = index(rng);
+        trainer.Train(X[i], Y[i]);
+    }
+    const double baseline = samples / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Mode\t\tWorkers\tSamples/s\tSpeedup\tEfficiency\tError\n";
+    std::cout << "Single\t\t1\t" << std::setprecision(0) << baseline << std::setprecision(3)
+              << "\t\t1.000\t1.000\t\t" << std::defaultfloat << Evaluate(single, X, Y) << std::fixed << "\n";
+    for (const auto mode : { NN::DataParallelMode::AllReduce, NN::DataParallelMode::ParameterServer }) {
+        for (std::size_t workers = 1; workers <= maxWorkers; workers *= 2) {
+            NN::NeuralNetwork nn = initial;
+            NN::DataParallelTrainer parallel(nn, workers, learningRate, momentum);
+            parallel.SetMode(mode);
+            parallel.SetSyncInterval(syncInterval);
+            const auto report = parallel.Train(X, Y, samples);
+            // Эффективность масштабирования - ускорение относительно
+            // одного процесса, делённое на количество процессов
+            const double speedup = report.SamplesPerSecond() / baseline;
+            std::cout << (mode == NN::DataParallelMode::AllReduce ? "AllReduce\t" : "ParamServer\t")
+                      << workers << "\t" << std::setprecision(0) << report.SamplesPerSecond() << std::setprecision(3)
+                      << "\t\t" << speedup << "\t" << speedup / workers
+                      << "\t\t" << std::defaultfloat << Evaluate(nn, X, Y) << std::fixed << "\n";
+        }
+    }
+    return 0;
+}
@@ -1,9 +1,17 @@
 ﻿#include <iostream>
+#include <fstream>
+#include <algorithm>
 #include <iomanip>
 #include <random>
 
 #include "NeuralNetwork.hpp"
 #include "NeuralNetworkTrainer.hpp"
+#include "Telemetry.hpp"
+#include "Validator.hpp"
+#include "KernelAutotuner.hpp"
+#include "Pruner.hpp"
+#include "SparseNeuralNetwork.hpp"
+#include "CodeGenerator.hpp"
 
 #if defined(WIN32)
 #   define WIN32_LEAN_AND_MEAN
@@ -22,7 +30,7 @@
  */
 void PrintSymbol(const NN::Vector& symbol)
 {
-    std::cout << std::endl;
+    std::cout << "\n";
     for (std::size_t i = 0; i < 7; i++) {
         for (std::size_t j = 0; j < 5; j++) {
             auto value = symbol[5 * i + j];
@@ -33,9 +41,9 @@ void PrintSymbol(const NN::Vector& symbol)
                 std::cout << u8"\u2591\u2591"; // ░░
             }
         }
-        std::cout << std::endl;
+        std::cout << "\n";
     }
-    std::cout << std::endl;
+    std::cout << "\n";
 }
 
 /**
@@ -45,9 +53,9 @@ void PrintSymbol(const NN::Vector& symbol)
  */
 void PrintResult(const NN::Vector& result)
 {
-    std::cout << "Output\tResult" << std::endl;
+    std::cout << "Output\tResult\n";
     for (std::size_t i = 0; i < result.Size(); i++) {
-        std::cout << i << "\t" << result[i] << std::endl;
+        std::cout << i << "\t" << result[i] << "\n";
     }
 }
 
@@ -141,14 +149,29 @@ std::vector<NN::Vector> Y = {
 
 // Максимальное количество эпох
 const std::size_t epochs = 1000000;
-// Скорость обучения
-const double learningRate = 0.5;
+// Скорость обучения. Градиенты перекрёстной энтропии не ослабляются производной сигмоиды,
+// поэтому скорость обучения меньше, чем при среднеквадратичной ошибке
+const double learningRate = 0.2;
 //
 const double momentum = 0.5;
-// Минимальная ошибка
-const double epsilon = 1e-6;
+// Минимальная ошибка. Перекрёстная энтропия 1e-3 соответствует
+// вероятности правильного класса не меньше 0.999
+const double epsilon = 1e-3;
+// Количество шагов обучения между проверками на отложенных данных
+const std::size_t validationInterval = 1000;
+// Количество проверок без улучшения до ранней остановки
+const std::size_t patience = 10;
+// Количество зашумлённых копий каждого символа в отложенных данных
+const std::size_t noisyCopies = 20;
+// Вероятность инвертирования пикселя в зашумлённой копии
+const double noise = 0.1;
+// Доля обнуляемых весов при прореживании
+const double targetSparsity = 0.8;
+// Количество шагов прореживания
+const std::size_t pruningStages = 4;
 
 // TODO: Добавить возможность задавать параметры сети из командной строки
+// Использование: AppDigits [путь к генерируемому заголовочному файлу с обученной сетью]
 int main (int argc, char *argv[]){
     // Костыль для винды
 #if defined(WIN32)
@@ -157,10 +180,16 @@ int main (int argc, char *argv[]){
     // Нейронная сеть
     NN::NeuralNetwork nn(35, {                               // 35 входов
         { 35, NN::ActivationFunction::Sigmoid, 1.0 },    // Скрытый слой: 35 нейронов, функция активации - сигмоида
-        { 10, NN::ActivationFunction::Sigmoid, 1.0 }     // Выходной слой: 10 нейронов, функция активации - сигмоида
+        { 10, NN::ActivationFunction::Softmax, 1.0 }     // Выходной слой: 10 нейронов, функция активации - softmax
     });
+    // Подбираем ядра умножения матриц весов на вектор для слоёв сети.
+    // Результаты подбора сохраняются в файл и используются при следующих запусках
+    NN::KernelAutotuner autotuner("kernels.cache");
+    autotuner.Apply(nn);
     // Обучатель нейронной сети
-    NN::NeuralNetworkTrainer nnTrainer(nn, learningRate, momentum);
+    // Функция потерь - перекрёстная энтропия: для классификации градиенты
+    // не затухают при насыщении выходов, и обучение сходится быстрее
+    NN::NeuralNetworkTrainer nnTrainer(nn, learningRate, momentum, NN::LossFunction::CrossEntropy);
     // Генератор случайных чисел
     std::random_device rd;
     // Движок генерации случайных чисел
@@ -170,34 +199,96 @@ int main (int argc, char *argv[]){
     nnTrainer.Init(-0.5, 0.5, rng);
     // Начальная эпоха
     std::size_t epoch = 1;
-    // Текущая ошибка сети
+    // Текущая ошибка сети - наибольшая из последних ошибок на каждом образце.
+    // Ошибка на одном случайном образце может оказаться малой случайно
     double error = 0.0;
+    // Последние ошибки сети на каждом образце
+    std::vector<double> errors(X.size(), 1.0);
     // Нормальное распределение от 0 до 9 (количество входных\выходных данных)
     std::uniform_int_distribution<std::size_t> ds(0, X.size() - 1);
-    // Запускаем цикл обучения
-    do {
-        // Генерируем индекс
-        auto index = ds(rng);
-        // Выбираем случайную пару входных и выходных данных и отправляем в обучатель
-        error = nnTrainer.Train(X[index], Y[index]);
-        if (epoch % 1000 == 0){
-            // Выводим ошибку. Чтобы не забивать консоль сообщениями
-            // выводим только когда эпоха кратна 1000
-            std::cout << "Epoch: " << epoch << ", Error: " << error << std::endl;
+    // Отложенные данные: символы с инвертированными случайными пикселями.
+    // На них сеть не обучается, по ним выбирается лучшая версия сети
+    std::vector<NN::Vector> validationX, validationY;
+    std::bernoulli_distribution flip(noise);
+    for (std::size_t copy = 0; copy < noisyCopies; copy++) {
+        for (std::size_t i = 0; i < X.size(); i++) {
+            NN::Vector symbol = X[i];
+            for (std::size_t j = 0; j < symbol.Size(); j++) {
+                if (flip(rng)) {
+                    symbol[j] = 1.0 - symbol[j];
+                }
+            }
+            validationX.push_back(symbol);
+            validationY.push_back(Y[i]);
         }
-        epoch++;
-    // Выполняем обучение до тех пор, пока не будет достигнуто максимальное количество эпох,
-    // либо пока не получим достаточную точность нейронной сети
-    } while (epoch <= epochs && error > epsilon);
+    }
+    // Проверка выполняется в отдельном потоке и не останавливает обучение
+    NN::Validator validator(nn, validationX, validationY, NN::LossFunction::CrossEntropy, patience);
+    {
+        // Ход обучения выводит фоновый поток телеметрии,
+        // чтобы вывод на консоль не замедлял цикл обучения.
+        // Чтобы не забивать консоль сообщениями, выводим каждую тысячную запись
+        NN::Telemetry telemetry(std::cout, NN::TelemetryFormat::Console, 1000);
+        nnTrainer.SetTelemetry(&telemetry);
+        // Запускаем цикл обучения
+        do {
+            // Генерируем индекс
+            auto index = ds(rng);
+            // Выбираем случайную пару входных и выходных данных и отправляем в обучатель
+            errors[index] = nnTrainer.Train(X[index], Y[index]);
+            error = *std::max_element(errors.begin(), errors.end());
+            if (epoch % validationInterval == 0) {
+                // Передаём копию весов на проверку
+                validator.Submit(nn, nnTrainer.Steps());
+            }
+            epoch++;
+        // Выполняем обучение до тех пор, пока не будет достигнуто максимальное количество эпох,
+        // либо пока не получим достаточную точность нейронной сети,
+        // либо пока ошибка на отложенных данных не перестанет уменьшаться
+        } while (epoch <= epochs && error > epsilon && !validator.ShouldStop());
+        nnTrainer.SetTelemetry(nullptr);
+        // Деструктор телеметрии выводит оставшиеся записи
+    }
     // Выводим ошибку
-    std::cout << "Epoch: " << epoch << ", Error: " << error << std::endl;
+    std::cout << "Epoch: " << epoch << ", Error: " << error << "\n";
+    // Проверяем последнюю версию и продолжаем с лучшей
+    validator.Submit(nn, nnTrainer.Steps());
+    validator.Wait();
+    const auto best = validator.Best();
+    std::cout << "Best validation: epoch " << best.epoch << ", loss " << best.loss
+              << ", accuracy " << best.accuracy << (validator.ShouldStop() ? " (early stop)" : "") << "\n";
+    nn = validator.BestModel();
+    // Прореживаем обученную сеть постепенно: после каждого шага прореживания
+    // дообучаем её, пока ошибка снова не станет меньше минимальной
+    NN::Pruner pruner(nn);
+    for (std::size_t stage = 1; stage <= pruningStages; stage++) {
+        pruner.Prune(targetSparsity * stage / pruningStages, NN::PruningScope::Global);
+        std::fill(errors.begin(), errors.end(), 1.0);
+        std::size_t step = 0;
+        do {
+            auto index = ds(rng);
+            errors[index] = pruner.Train(nnTrainer, X[index], Y[index]);
+            error = *std::max_element(errors.begin(), errors.end());
+            step++;
+        } while (step < epochs && error > epsilon);
+        std::cout << "Sparsity: " << pruner.Sparsity() << ", Steps: " << step << ", Error: " << error << "\n";
+    }
+    // Для прямого прохода храним только ненулевые веса
+    NN::SparseNeuralNetwork sparse(nn);
+    std::cout << "Weights memory: " << sparse.DenseMemorySize() << " -> " << sparse.MemorySize() << " bytes\n";
+    if (argc > 1) {
+        // Генерируем автономный код прямого прохода для встраивания
+        std::ofstream header(argv[1]);
+        NN::CodeGenerator::Generate(nn, header, "Digits");
+        std::cout << "Generated: " << argv[1] << "\n";
+    }
     // Проверяем обученную нейронную сеть,
     // последовательно подавая в сеть пары входных данных
     // и выводя результат
     // TODO: Сгенерировать случайные изображения и проверить на них работу сети
     for (int i = 0; i < X.size(); i++) {
         // Делаем прямой проход по сети
-        NN::Vector output = nn.Forward(X[i]);
+        NN::Vector output = sparse.Forward(X[i]);
         // Выводим символ
         PrintSymbol(X[i]);
         // Выводим результат
@@ -0,0 +1,121 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "InferenceCache.hpp"
+#include "JitNeuralNetwork.hpp"
+#include "LatencyExecutor.hpp"
+#include "NeuralNetwork.hpp"
+#include "NeuralNetworkTrainer.hpp"
+
+/**
+ * Сравнение способов прямого прохода одного запроса.
+ * Для каждого способа выводится задержка запроса и наибольшее отличие
+ * выходов от NeuralNetwork::Forward на тех же запросах.
+ */
+
+// Количество входов
+const std::size_t inputs = 784;
+// Количество нейронов скрытых слоёв
+const std::size_t hidden = 512;
+// Количество выходов
+const std::size_t outputs = 10;
+// Количество запросов
+const std::size_t queries = 2000;
+// Количество разных входов среди повторяющихся запросов
+const std::size_t distinct = 200;
+
+/**
+ * Выполнение запросов одним способом и вывод результата.
+ *
+ * \param name Название способа
+ * \param X Запросы
+ * \param expected Выходы NeuralNetwork::Forward
+ * \param forward Прямой проход
+ */
+template<class Forward>
+void Measure(const std::string& name, const std::vector<NN::Vector>& X, const std::vector<NN::Vector>& expected, Forward forward)
+{
+    std::vector<NN::Vector> results(X.size());
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < X.size(); i++) {
+        results[i] = forward(X[i]);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double difference = 0.0;
+    for (std::size_t i = 0; i < X.size(); i++) {
+        for (std::size_t j = 0; j < results[i].Size(); j++) {
+            difference = std::max(difference, std::fabs(results[i][j] - expected[i][j]));
+        }
+    }
+    std::cout << std::left << std::setw(16) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(12) << seconds / X.size() * 1e6
+              << std::defaultfloat << std::setw(16) << difference << "\n";
+}
+
+// Использование: AppInference [количество скрытых слоёв]
+int main (int argc, char *argv[]){
+    const std::size_t hiddenLayers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2;
+    std::mt19937 rng(1);
+    std::vector<NN::LayerConfig> layers(hiddenLayers, { hidden, NN::ActivationFunction::ReLU, 1.0 });
+    layers.push_back({ outputs, NN::ActivationFunction::Softmax, 1.0 });
+    NN::NeuralNetwork nn(inputs, layers);
+    NN::NeuralNetworkTrainer(nn, 0.1, 0.9).Init(-0.05, 0.05, rng);
+    std::uniform_real_distribution<double> ds(0.0, 1.0);
+    std::vector<NN::Vector> X;
+    for (std::size_t i = 0; i < queries; i++) {
+        NN::Vector x(inputs);
+        for (std::size_t j = 0; j < inputs; j++) {
+            x[j] = ds(rng);
+        }
+        X.push_back(x);
+    }
+    std::vector<NN::Vector> expected;
+    for (const auto& x : X) {
+        expected.push_back(nn.Forward(x));
+    }
+
+    NN::JitNeuralNetwork jit(nn);
+    std::size_t compiled = 0;
+    for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+        compiled += jit.Compiled(layer) ? 1 : 0;
+    }
+    std::cout << "Network: " << inputs << " x " << hiddenLayers << " x " << hidden << " -> " << outputs
+              << ", JIT layers: " << compiled << " of " << nn.LayersCount() << "\n\n";
+    std::cout << std::left << std::setw(16) << "Method" << std::right
+              << std::setw(12) << "us/query" << std::setw(16) << "Max difference" << "\n";
+    Measure("NeuralNetwork", X, expected, [&](const NN::Vector& x) { return nn.Forward(x); });
+    Measure("JIT", X, expected, [&](const NN::Vector& x) { return jit.Forward(x); });
+    std::size_t threads = 0;
+    std::size_t parallel = 0;
+    {
+        // Потоки пула вращаются всё время жизни исполнителя,
+        // поэтому он создаётся только на время своего измерения
+        NN::LatencyExecutor executor(nn);
+        Measure("Latency", X, expected, [&](const NN::Vector& x) { return executor.Forward(x); });
+        threads = executor.Threads();
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            parallel += executor.Parallel(layer) ? 1 : 0;
+        }
+    }
+    // Кэш полезен только для повторяющихся входов: запросы выбираются из небольшого набора
+    std::uniform_int_distribution<std::size_t> di(0, distinct - 1);
+    std::vector<NN::Vector> repeatedX, repeatedExpected;
+    for (std::size_t i = 0; i < queries; i++) {
+        const std::size_t index = di(rng);
+        repeatedX.push_back(X[index]);
+        repeatedExpected.push_back(expected[index]);
+    }
+    NN::InferenceCache cache(nn);
+    Measure("Cache", repeatedX, repeatedExpected, [&](const NN::Vector& x) { return cache.Forward(x); });
+    const auto stats = cache.Stats();
+    std::cout << "\nLatency executor: " << threads << " threads, " << parallel << " of " << nn.LayersCount() << " layers split\n";
+    std::cout << "Cache: " << distinct << " distinct inputs, hit rate " << stats.HitRate()
+              << ", entries " << stats.entries << ", evictions " << stats.evictions << "\n";
+    return 0;
+}
@@ -0,0 +1,100 @@
+﻿#include <iostream>
+#include <cstdlib>
+#include <iomanip>
+#include <random>
+#include <thread>
+
+#include "NeuralNetwork.hpp"
+#include "NeuralNetworkTrainer.hpp"
+#include "PipelineTrainer.hpp"
+
+/**
+ * Обучение глубокой нейронной сети конвейером потоков.
+ * Сравнивает пропускную способность и простой конвейера
+ * при разном количестве стадий, микропакетов и порядке проходов.
+ */
+
+// Количество входов
+const std::size_t inputs = 64;
+// Количество нейронов скрытых слоёв
+const std::size_t hidden = 256;
+// Количество скрытых слоёв
+const std::size_t hiddenLayers = 4;
+// Количество выходов
+const std::size_t outputs = 10;
+// Количество обучающих примеров
+const std::size_t examples = 2048;
+// Количество примеров в пакете
+const std::size_t batch = 32;
+// Скорость обучения
+const double learningRate = 0.1;
+// Момент: доля предыдущего изменения весов, добавляемая к текущему
+const double momentum = 0.9;
+
+/**
+ * Вычисление среднеквадратичной ошибки на всех обучающих примерах.
+ */
+double Evaluate(const NN::NeuralNetwork& nn, const std::vector<NN::Vector>& X, const std::vector<NN::Vector>& Y)
+{
+    double error = 0.0;
+    for (std::size_t i = 0; i < X.size(); i++) {
+        const NN::Vector difference = nn.Forward(X[i]) - Y[i];
+        error += (difference ^ difference) / difference.Size();
+    }
+    return error / X.size();
+}
+
+// Использование: AppPipeline [максимальное количество стадий]
+int main (int argc, char *argv[]){
+    const std::size_t maxStages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : hiddenLayers + 1;
+    std::mt19937 rng(1);
+    // Обучающие данные: выходы "учителя" - небольшой сети со случайными весами
+    NN::NeuralNetwork teacher(inputs, {
+        { 32, NN::ActivationFunction::Tanh, 1.0 },
+        { outputs, NN::ActivationFunction::Sigmoid, 1.0 }
+    });
+    NN::NeuralNetworkTrainer(teacher, learningRate, momentum).Init(-1.0, 1.0, rng);
+    std::uniform_real_distribution<double> ds(-1.0, 1.0);
+    std::vector<NN::Vector> X, Y;
+    for (std::size_t i = 0; i < examples; i++) {
+        NN::Vector x(inputs);
+        for (std::size_t j = 0; j < inputs; j++) {
+            x[j] = ds(rng);
+        }
+        X.push_back(x);
+        Y.push_back(teacher.Forward(x));
+    }
+    // Начальные веса одинаковы во всех запусках
+    std::vector<NN::LayerConfig> layers(hiddenLayers, { hidden, NN::ActivationFunction::Tanh, 1.0 });
+    layers.push_back({ outputs, NN::ActivationFunction::Sigmoid, 1.0 });
+    NN::NeuralNetwork initial(inputs, layers);
+    NN::NeuralNetworkTrainer(initial, learningRate, momentum).Init(-0.1, 0.1, rng);
+    std::cout << "Processors: " << std::thread::hardware_concurrency()
+              << ", initial error: " << Evaluate(initial, X, Y) << "\n\n";
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Schedule\tStages\tMicro\tSamples/s\tBubble\tIdeal\tError\t\tUtilization\n";
+    for (const auto schedule : { NN::PipelineSchedule::GPipe, NN::PipelineSchedule::OneForwardOneBackward }) {
+        for (std::size_t stages = 1; stages <= maxStages && stages <= layers.size(); stages++) {
+            for (const std::size_t microBatches : { 2, 8 }) {
+                NN::NeuralNetwork nn = initial;
+                NN::PipelineTrainer pipeline(nn, stages, learningRate, momentum);
+                pipeline.SetSchedule(schedule);
+                pipeline.SetMicroBatches(microBatches, batch / microBatches);
+                const auto report = pipeline.Train(X, Y);
+                // Доля простоя идеального конвейера с равными стадиями: (S - 1) / (M + S - 1)
+                const double ideal = static_cast<double>(stages - 1) / (microBatches + stages - 1);
+                std::cout << (schedule == NN::PipelineSchedule::GPipe ? "GPipe\t\t" : "1F1B\t\t")
+                          << stages << "\t" << microBatches << "\t"
+                          << std::setprecision(0) << report.samples / report.seconds << std::setprecision(3)
+                          << "\t\t" << report.Bubble() << "\t" << ideal
+                          << "\t" << std::defaultfloat << Evaluate(nn, X, Y) << std::fixed << "\t";
+                for (const auto& stage : report.stages) {
+                    std::cout << " [" << stage.firstLayer << "-" << stage.lastLayer - 1 << "] " << stage.utilization;
+                }
+                std::cout << "\n";
+            }
+        }
+    }
+    return 0;
+}
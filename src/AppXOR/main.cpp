@@ -1,8 +1,13 @@
-﻿#include <iostream>
+﻿#include <algorithm>
+#include <iostream>
 #include <random>
+#include <string>
 
+#include "LbfgsTrainer.hpp"
 #include "NeuralNetwork.hpp"
 #include "NeuralNetworkTrainer.hpp"
+#include "PopulationTrainer.hpp"
+#include "Telemetry.hpp"
 
 #if defined(WIN32)
 #   define WIN32_LEAN_AND_MEAN
@@ -38,18 +43,40 @@ const double learningRate = 0.5;
 const double momentum = 0.5;
 // Минимальная ошибка
 const double epsilon = 1e-5;
+// Максимальное количество итераций L-BFGS
+const std::size_t lbfgsIterations = 1000;
+// Скорости обучения и моменты моделей популяции
+const std::vector<double> populationLearningRates = { 0.5, 1.0, 2.0, 4.0, 0.5, 1.0, 2.0, 4.0 };
+const std::vector<double> populationMomentums = { 0.5, 0.5, 0.5, 0.5, 0.9, 0.9, 0.9, 0.9 };
 
+/**
+ * Проверка обученной нейронной сети: последовательно подаём в сеть
+ * пары входных данных и выводим результат.
+ */
+void Check(const NN::NeuralNetwork& nn)
+{
+    for (int i = 0; i < X.size(); i++) {
+        // Делаем прямой проход по сети
+        NN::Vector output = nn.Forward(X[i]);
+        // Выводим результат
+        std::cout << "X: " << X[i][0] << " " << X[i][1] << ", Output: " << output[0] << "\n";
+    }
+}
+
+// Использование: AppXOR [--lbfgs | --population]
 // TODO: Добавить возможность задавать параметры сети из командной строки
 int main (int argc, char *argv[]){
     // Костыль для винды
 #if defined(WIN32)
     SetConsoleOutputCP(65001);
 #endif
-    // Нейронная сеть
-    NN::NeuralNetwork nn(2, {                   // 2 входа
+    // Конфигурация слоёв
+    const std::vector<NN::LayerConfig> layers = {
         {2, NN::ActivationFunction::Sigmoid, 1.0 },  // Скрытый слой: 2 нейрона, функция активации - сигмоида
         {1, NN::ActivationFunction::Sigmoid, 1.0 }   // Выходной слой: 1 нейрон, функция активации - сигмоида
-    });
+    };
+    // Нейронная сеть: 2 входа
+    NN::NeuralNetwork nn(2, layers);
     // Обучатель нейронной сети
     NN::NeuralNetworkTrainer nnTrainer(nn, learningRate, momentum);
     // Генератор случайных чисел
@@ -59,37 +86,78 @@ int main (int argc, char *argv[]){
     rng.seed(1);
     // Инициализируем веса нейронной сети
     nnTrainer.Init(-0.5, 0.5, rng);
+    if (argc > 1 && std::string(argv[1]) == "--lbfgs") {
+        // Четыре примера - вся выборка сразу помещается в кэш,
+        // поэтому сеть можно обучить квазиньютоновским методом по полному градиенту
+        NN::LbfgsTrainer lbfgsTrainer(nn, NN::LossFunction::MeanSquaredError, 1);
+        lbfgsTrainer.SetTolerance(1e-8, epsilon);
+        // Без ограничения первые длинные шаги уводят сеть в локальный минимум с насыщенными нейронами
+        lbfgsTrainer.SetMaxStep(1.0);
+        const auto report = lbfgsTrainer.Train(X, Y, lbfgsIterations);
+        std::cout << "Iterations: " << report.iterations << ", Evaluations: " << report.evaluations
+                  << ", Error: " << report.loss << (report.converged ? "" : " (not converged)") << "\n";
+        Check(nn);
+        return 0;
+    }
     // Начальная эпоха
     std::size_t epoch = 1;
     // Текущая ошибка сети
     double error = 0.0;
     // Нормальное распределение от 0 до 3 (количество входных\выходных данных)
     std::uniform_int_distribution<std::size_t> ds(0, X.size() - 1);
-    // Запускаем цикл обучения
-    do {
-        // Генерируем индекс
-        auto index = ds(rng);
-        // Выбираем случайную пару входных и выходных данных и отправляем в обучатель
-        error = nnTrainer.Train(X[index], Y[index]);
-        if (epoch % 1000 == 0){
-            // Выводим ошибку. Чтобы не забивать консоль сообщениями
-            // выводим только когда эпоха кратна 1000
-            std::cout << "Epoch: " << epoch << ", Error: " << error << std::endl;
+    if (argc > 1 && std::string(argv[1]) == "--population") {
+        // Подбор гиперпараметров: модели с разными скоростями обучения и моментами
+        // обучаются одновременно на одних и тех же примерах
+        NN::PopulationTrainer population(2, layers, populationLearningRates, populationMomentums);
+        for (std::size_t model = 0; model < population.ModelsCount(); model++) {
+            population.Init(model, -0.5, 0.5, rng);
         }
-        epoch++;
-    // Выполняем обучение до тех пор, пока не будет достигнуто максимальное количество эпох,
-    // либо пока не получим достаточную точность нейронной сети
-    } while (epoch <= epochs && error > epsilon);
-    // Выводим ошибку
-    std::cout << "Epoch: " << epoch << ", Error: " << error << std::endl;
-    // Проверяем обученную нейронную сеть,
-    // последовательно подавая в сеть пары входных данных
-    // и выводя результат
-    for (int i = 0; i < X.size(); i++) {
-        // Делаем прямой проход по сети
-        NN::Vector output = nn.Forward(X[i]);
-        // Выводим результат
-        std::cout << "X: " << X[i][0] << " " << X[i][1] << ", Output: " << output[0] << std::endl;
+        // Последние ошибки каждой модели на каждом образце
+        std::vector<std::vector<double>> errors(population.ModelsCount(), std::vector<double>(X.size(), 1.0));
+        std::size_t best = 0;
+        do {
+            auto index = ds(rng);
+            const NN::Vector modelErrors = population.Train(X[index], Y[index]);
+            // Лучшая модель - с наименьшей из последних ошибок на худшем образце
+            for (std::size_t model = 0; model < population.ModelsCount(); model++) {
+                errors[model][index] = modelErrors[model];
+                if (*std::max_element(errors[model].begin(), errors[model].end())
+                    < *std::max_element(errors[best].begin(), errors[best].end())) {
+                    best = model;
+                }
+            }
+            error = *std::max_element(errors[best].begin(), errors[best].end());
+            epoch++;
+        } while (epoch <= epochs && error > epsilon);
+        std::cout << "Epoch: " << epoch << ", Best model: " << best
+                  << " (learning rate " << populationLearningRates[best] << ", momentum " << populationMomentums[best]
+                  << "), Error: " << error << "\n";
+        nn = population.Extract(best);
+        Check(nn);
+        return 0;
     }
+    {
+        // Ход обучения выводит фоновый поток телеметрии,
+        // чтобы вывод на консоль не замедлял цикл обучения.
+        // Чтобы не забивать консоль сообщениями, выводим каждую тысячную запись
+        NN::Telemetry telemetry(std::cout, NN::TelemetryFormat::Console, 1000);
+        nnTrainer.SetTelemetry(&telemetry);
+        // Запускаем цикл обучения
+        do {
+            // Генерируем индекс
+            auto index = ds(rng);
+            // Выбираем случайную пару входных и выходных данных и отправляем в обучатель
+            error = nnTrainer.Train(X[index], Y[index]);
+            epoch++;
+        // Выполняем обучение до тех пор, пока не будет достигнуто максимальное количество эпох,
+        // либо пока не получим достаточную точность нейронной сети
+        } while (epoch <= epochs && error > epsilon);
+        nnTrainer.SetTelemetry(nullptr);
+        // Деструктор телеметрии выводит оставшиеся записи
+    }
+    // Выводим ошибку
+    std::cout << "Epoch: " << epoch << ", Error: " << error << "\n";
+    // Проверяем обученную нейронную сеть
+    Check(nn);
     return 0;
 }
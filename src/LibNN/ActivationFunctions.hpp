@@ -1,13 +1,53 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <stdexcept>
 
 namespace NN
 {
 
+/**
+ * Тип функции активации.
+ */
+enum class ActivationFunction
+{
+    Sigmoid,    // Сигмоида
+    ReLU,       // Линейный выпрямитель
+    LeakyReLU,  // Линейный выпрямитель с утечкой
+    Tanh,       // Гиперболический тангенс
+    Softplus,   // Гладкий выпрямитель ln(1 + e^x)
+    GELU,       // Гауссова линейная единица x * Ф(x)
+    Softmax     // Нормированная экспонента, применяется ко всему слою
+};
+
+/**
+ * Точность вычисления функций активации.
+ * Погрешности указаны для экспоненты (относительная погрешность).
+ * Сигмоида наследует относительную погрешность экспоненты,
+ * гиперболический тангенс и гладкий выпрямитель - абсолютную погрешность
+ * того же порядка, GELU - абсолютную погрешность не больше 0.5 * |x| * (погрешность erf),
+ * где погрешность erf = 1.5e-7 + погрешность экспоненты.
+ */
+enum class ActivationAccuracy
+{
+    Exact,  // Стандартная библиотека
+    High,   // Полином 6-й степени, погрешность не больше 1.7e-7
+    Fast    // Полином 4-й степени, погрешность не больше 5.6e-5
+};
+
 namespace detail{
 
-    // TODO: Реализовать другие функции активации
+    // Наклон линейного выпрямителя с утечкой при отрицательных значениях
+    constexpr double LeakyReLUSlope = 0.01;
+    // 1 / sqrt(2)
+    constexpr double InvSqrt2 = 0.70710678118654752440;
+    // 1 / sqrt(2 * pi)
+    constexpr double InvSqrt2Pi = 0.39894228040143267794;
+
     /**
      * Сигмоидальная функция активации.
      *
@@ -22,23 +62,208 @@ namespace detail{
      * Производная сигмоидальной функции активации.
      *
      * \param input Входное значение
+     * \param output Значение функции
      * \return Значение производной сигмоидальной функции
      */
-    static double SigmoidDerivative(const double input)
+    static double SigmoidDerivative(const double, const double output)
+    {
+        return output * (1.0 - output);
+    }
+    // Линейный выпрямитель и его производная
+    static double ReLU(const double input)
+    {
+        return input > 0.0 ? input : 0.0;
+    }
+    static double ReLUDerivative(const double input, const double)
+    {
+        return input > 0.0 ? 1.0 : 0.0;
+    }
+    // Линейный выпрямитель с утечкой и его производная
+    static double LeakyReLU(const double input)
+    {
+        return input > 0.0 ? input : LeakyReLUSlope * input;
+    }
+    static double LeakyReLUDerivative(const double input, const double)
     {
-        return input * (1.0 - input);
+        return input > 0.0 ? 1.0 : LeakyReLUSlope;
+    }
+    // Гиперболический тангенс и его производная
+    static double Tanh(const double input)
+    {
+        return std::tanh(input);
+    }
+    static double TanhDerivative(const double, const double output)
+    {
+        return 1.0 - output * output;
+    }
+    // Гладкий выпрямитель и его производная (сигмоида)
+    static double Softplus(const double input)
+    {
+        // Запись без переполнения экспоненты при больших входных значениях
+        return std::max(input, 0.0) + std::log1p(std::exp(-std::abs(input)));
+    }
+    static double SoftplusDerivative(const double input, const double)
+    {
+        return Sigmoid(input);
+    }
+    // GELU и её производная Ф(x) + x * ф(x)
+    static double GELU(const double input)
+    {
+        return 0.5 * input * (1.0 + std::erf(input * InvSqrt2));
+    }
+    static double GELUDerivative(const double input, const double)
+    {
+        return 0.5 * (1.0 + std::erf(input * InvSqrt2))
+            + input * InvSqrt2Pi * std::exp(-0.5 * input * input);
     }
 
-}
+    /**
+     * Приближённая экспонента без ветвлений.
+     * x = k * ln(2) + r, |r| <= ln(2) / 2, e^x = 2^k * P(r),
+     * где P - многочлен Тейлора степени Degree.
+     */
+    template<int Degree>
+    struct PolynomialExp
+    {
+        double operator () (double x) const
+        {
+            // Ограничиваем диапазон, чтобы 2^k оставалось нормализованным числом
+            x = std::min(std::max(x, -708.0), 709.0);
+            // Округление x / ln(2) до целого прибавлением 1.5 * 2^52:
+            // целая часть оказывается в младших битах мантиссы
+            constexpr double shifter = 6755399441055744.0;
+            double kd = x * 1.4426950408889634 + shifter;
+            std::int64_t kBits, shifterBits;
+            std::memcpy(&kBits, &kd, sizeof(kd));
+            std::memcpy(&shifterBits, &shifter, sizeof(shifter));
+            kd -= shifter;
+            const std::int64_t k = kBits - shifterBits;
+            // Редукция аргумента, ln(2) разбит на две части для точности
+            const double r = x - kd * 6.93147180369123816490e-01 - kd * 1.90821492927058770002e-10;
+            // Многочлен по схеме Горнера
+            const double p = Horner<1>(r);
+            // Собираем 2^k из битов показателя
+            const std::int64_t scaleBits = (k + 1023) << 52;
+            double scale;
+            std::memcpy(&scale, &scaleBits, sizeof(scale));
+            return p * scale;
+        }
+    private:
+        /**
+         * Схема Горнера для многочлена Тейлора экспоненты:
+         * 1 + r * (1 + r / 2 * (1 + r / 3 * (...))).
+         * Раскрывается на этапе компиляции, коэффициенты - константы.
+         */
+        template<int I>
+        static double Horner(const double r)
+        {
+            if constexpr (I > Degree) {
+                return 1.0;
+            }
+            else {
+                return 1.0 + r * (1.0 / I) * Horner<I + 1>(r);
+            }
+        }
+    };
 
-/**
- * Тип функции активации.
- */
-// TODO: Добавить другие функции активации
-enum class ActivationFunction
-{
-    Sigmoid     // Сигмоида
-};
+    /**
+     * Функция ошибок erf по формуле 7.1.26 Абрамовица и Стиган
+     * (абсолютная погрешность не больше 1.5e-7 при точной экспоненте).
+     */
+    template<class Exp>
+    inline double Erf(const double x, const Exp& exp)
+    {
+        const double z = std::abs(x);
+        const double t = 1.0 / (1.0 + 0.3275911 * z);
+        const double poly = t * (0.254829592 + t * (-0.284496736
+            + t * (1.421413741 + t * (-1.453152027 + t * 1.061405429))));
+        return std::copysign(1.0 - poly * exp(-z * z), x);
+    }
+
+    /**
+     * Нормированная экспонента. Максимум вычитается для устойчивости к переполнению.
+     */
+    template<class Exp>
+    inline void Softmax(const Exp& exp, const double* input, double* output, const std::size_t size)
+    {
+        if (size == 0) {
+            return;
+        }
+        const double max = *std::max_element(input, input + size);
+        double sum = 0.0;
+        for (std::size_t i = 0; i < size; i++) {
+            output[i] = exp(input[i] - max);
+            sum += output[i];
+        }
+        const double inverseSum = 1.0 / sum;
+        for (std::size_t i = 0; i < size; i++) {
+            output[i] *= inverseSum;
+        }
+    }
+
+    /**
+     * Применение функции к каждому значению.
+     */
+    template<class Fn>
+    inline void Map(const Fn& fn, const double* input, double* output, const std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; i++) {
+            output[i] = fn(input[i]);
+        }
+    }
+
+    /**
+     * Пакетное вычисление функции активации.
+     * Выбор функции вынесен из цикла, а экспонента вычисляется без вызовов и ветвлений,
+     * поэтому компилятор может векторизовать циклы (кроме гладкого выпрямителя,
+     * которому нужен log1p).
+     */
+    template<class Exp>
+    inline void Activate(
+        const ActivationFunction fn,
+        const Exp& exp,
+        const double* input,
+        double* output,
+        const std::size_t size)
+    {
+        switch (fn) {
+        case ActivationFunction::Sigmoid:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = 1.0 / (1.0 + exp(-input[i]));
+            }
+            break;
+        case ActivationFunction::ReLU:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = std::max(input[i], 0.0);
+            }
+            break;
+        case ActivationFunction::LeakyReLU:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = input[i] > 0.0 ? input[i] : LeakyReLUSlope * input[i];
+            }
+            break;
+        case ActivationFunction::Tanh:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = 1.0 - 2.0 / (exp(2.0 * input[i]) + 1.0);
+            }
+            break;
+        case ActivationFunction::Softplus:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = std::max(input[i], 0.0) + std::log1p(exp(-std::abs(input[i])));
+            }
+            break;
+        case ActivationFunction::GELU:
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = 0.5 * input[i] * (1.0 + Erf(input[i] * InvSqrt2, exp));
+            }
+            break;
+        case ActivationFunction::Softmax:
+            Softmax(exp, input, output, size);
+            break;
+        }
+    }
+
+}
 
 /**
  * Получение функции активации по типу.
@@ -46,27 +271,154 @@ enum class ActivationFunction
  * \param fn Тип функции активации
  * \return Функция активации
  */
-// TODO: MSVC - избавиться от варнинга C4715
-std::function<double(double)> GetFunction(const ActivationFunction fn)
+inline std::function<double(double)> GetFunction(const ActivationFunction fn) noexcept(false)
 {
     switch (fn) {
     case ActivationFunction::Sigmoid:
         return detail::Sigmoid;
+    case ActivationFunction::ReLU:
+        return detail::ReLU;
+    case ActivationFunction::LeakyReLU:
+        return detail::LeakyReLU;
+    case ActivationFunction::Tanh:
+        return detail::Tanh;
+    case ActivationFunction::Softplus:
+        return detail::Softplus;
+    case ActivationFunction::GELU:
+        return detail::GELU;
+    case ActivationFunction::Softmax:
+        throw std::invalid_argument("Softmax is not an element-wise function");
     }
+    throw std::invalid_argument("Unknown activation function");
 }
 
 /**
  * Получение производной функции активации по типу.
+ * Производная принимает входное значение функции и значение самой функции.
  *
  * \param fn Тип функции активации
  * \return Производная функции активации
  */
- // TODO: MSVC - избавиться от варнинга C4715
-std::function<double(double)> GetFunctionDerivative(const ActivationFunction fn)
+inline std::function<double(double, double)> GetFunctionDerivative(const ActivationFunction fn) noexcept(false)
 {
     switch (fn) {
     case ActivationFunction::Sigmoid:
         return detail::SigmoidDerivative;
+    case ActivationFunction::ReLU:
+        return detail::ReLUDerivative;
+    case ActivationFunction::LeakyReLU:
+        return detail::LeakyReLUDerivative;
+    case ActivationFunction::Tanh:
+        return detail::TanhDerivative;
+    case ActivationFunction::Softplus:
+        return detail::SoftplusDerivative;
+    case ActivationFunction::GELU:
+        return detail::GELUDerivative;
+    case ActivationFunction::Softmax:
+        throw std::invalid_argument("Softmax is not an element-wise function");
+    }
+    throw std::invalid_argument("Unknown activation function");
+}
+
+/**
+ * Пакетное вычисление функции активации.
+ *
+ * \param fn Тип функции активации
+ * \param accuracy Точность вычисления
+ * \param input Входные значения
+ * \param output Значения функции
+ * \param size Количество значений
+ */
+inline void Activate(
+    const ActivationFunction fn,
+    const ActivationAccuracy accuracy,
+    const double* input,
+    double* output,
+    const std::size_t size)
+{
+    switch (accuracy) {
+    case ActivationAccuracy::Exact:
+        // Точные значения вычисляем теми же функциями, что и GetFunction
+        switch (fn) {
+        case ActivationFunction::Sigmoid:   detail::Map(detail::Sigmoid, input, output, size); break;
+        case ActivationFunction::ReLU:      detail::Map(detail::ReLU, input, output, size); break;
+        case ActivationFunction::LeakyReLU: detail::Map(detail::LeakyReLU, input, output, size); break;
+        case ActivationFunction::Tanh:      detail::Map(detail::Tanh, input, output, size); break;
+        case ActivationFunction::Softplus:  detail::Map(detail::Softplus, input, output, size); break;
+        case ActivationFunction::GELU:      detail::Map(detail::GELU, input, output, size); break;
+        case ActivationFunction::Softmax:
+            detail::Softmax([](const double x) { return std::exp(x); }, input, output, size);
+            break;
+        }
+        break;
+    case ActivationAccuracy::High:
+        detail::Activate(fn, detail::PolynomialExp<6>(), input, output, size);
+        break;
+    case ActivationAccuracy::Fast:
+        detail::Activate(fn, detail::PolynomialExp<4>(), input, output, size);
+        break;
+    }
+}
+
+/**
+ * Пакетное умножение градиентов на производную функции активации.
+ *
+ * \param fn Тип функции активации
+ * \param input Входные значения функции
+ * \param output Значения функции
+ * \param gradient Градиенты, умножаются на месте
+ * \param size Количество значений
+ */
+inline void MultiplyByDerivative(
+    const ActivationFunction fn,
+    const double* input,
+    const double* output,
+    double* gradient,
+    const std::size_t size)
+{
+    switch (fn) {
+    case ActivationFunction::Sigmoid:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= output[i] * (1.0 - output[i]);
+        }
+        break;
+    case ActivationFunction::ReLU:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= input[i] > 0.0 ? 1.0 : 0.0;
+        }
+        break;
+    case ActivationFunction::LeakyReLU:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= input[i] > 0.0 ? 1.0 : detail::LeakyReLUSlope;
+        }
+        break;
+    case ActivationFunction::Tanh:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= 1.0 - output[i] * output[i];
+        }
+        break;
+    case ActivationFunction::Softplus:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= detail::SoftplusDerivative(input[i], output[i]);
+        }
+        break;
+    case ActivationFunction::GELU:
+        for (std::size_t i = 0; i < size; i++) {
+            gradient[i] *= detail::GELUDerivative(input[i], output[i]);
+        }
+        break;
+    case ActivationFunction::Softmax:
+        {
+            // Произведение матрицы Якоби softmax на вектор: p * (g - (g ^ p))
+            double dot = 0.0;
+            for (std::size_t i = 0; i < size; i++) {
+                dot += gradient[i] * output[i];
+            }
+            for (std::size_t i = 0; i < size; i++) {
+                gradient[i] = output[i] * (gradient[i] - dot);
+            }
+        }
+        break;
     }
 }
 
@@ -0,0 +1,301 @@
+﻿#pragma once
+
+#include <iomanip>
+#include <locale>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий генерацию автономного заголовочного файла C++
+ * с прямым проходом обученной нейронной сети.
+ * Веса записываются в выровненные массивы constexpr, размеры всех циклов -
+ * константы, поэтому компилятор может разворачивать и векторизовать циклы.
+ * Сгенерированный код не зависит от LibNN, не выделяет динамическую память
+ * и не требует инициализации при запуске: промежуточные выходы слоёв
+ * хранятся в массивах на стеке.
+ * Функции активации вычисляются точно (через функции <cmath>),
+ * независимо от точности, установленной в нейронной сети.
+ */
+class CodeGenerator
+{
+public:
+    /**
+     * Генерация заголовочного файла.
+     * Файл содержит пространство имён с константами Inputs и Outputs
+     * и функцией Forward(const double* input, double* output).
+     *
+     * \param nn Нейронная сеть
+     * \param out Поток вывода
+     * \param name Имя пространства имён сгенерированного кода, идентификатор C++
+     */
+    static void Generate(const NeuralNetwork& nn, std::ostream& out, const std::string& name) noexcept(false)
+    {
+        if (!IsIdentifier(name)) {
+            throw std::invalid_argument("Namespace name must be a C++ identifier");
+        }
+        std::ostringstream code;
+        // Вещественные числа записываются с точкой независимо от локали
+        // и с точностью, достаточной для точного восстановления значения
+        code.imbue(std::locale::classic());
+        code << std::setprecision(17);
+        const std::size_t layers = nn.LayersCount();
+        code << "// Сгенерировано NN::CodeGenerator. Не редактировать.\n"
+             << "#pragma once\n\n"
+             << "#include <cmath>\n"
+             << "#include <cstddef>\n\n"
+             << "namespace " << name << "\n{\n\n"
+             << "// Количество входов\n"
+             << "constexpr std::size_t Inputs = " << nn.LayerShape(0).Size() << ";\n"
+             << "// Количество выходов\n"
+             << "constexpr std::size_t Outputs = " << nn.LayerShape(layers).Size() << ";\n\n";
+        GenerateWeights(nn, code);
+        GenerateActivations(code);
+        code << "/**\n"
+             << " * Прямой проход по нейронной сети.\n"
+             << " *\n"
+             << " * \\param input Массив входных данных размером Inputs\n"
+             << " * \\param output Массив выходных данных размером Outputs\n"
+             << " */\n"
+             << "inline void Forward(const double* input, double* output)\n{\n";
+        for (std::size_t layer = 0; layer + 1 < layers; layer++) {
+            code << "    alignas(64) double layer" << layer << "[" << nn.LayerShape(layer + 1).Size() << "];\n";
+        }
+        for (std::size_t layer = 0; layer < layers; layer++) {
+            const std::string source = layer == 0 ? "input" : "layer" + std::to_string(layer - 1);
+            const std::string destination = layer + 1 == layers ? "output" : "layer" + std::to_string(layer);
+            switch (nn.m_layers[layer].type) {
+            case LayerType::Dense:
+                GenerateDense(nn, layer, source, destination, code);
+                break;
+            case LayerType::Convolution:
+                GenerateConvolution(nn, layer, source, destination, code);
+                break;
+            case LayerType::MaxPooling:
+                GenerateMaxPooling(nn, layer, source, destination, code);
+                break;
+            }
+        }
+        code << "}\n\n}\n";
+        out << code.str();
+    }
+private:
+    /**
+     * Проверка, является ли строка идентификатором C++: латинские буквы, цифры
+     * и подчёркивания, первый символ - не цифра. Ключевые слова не проверяются.
+     *
+     * \param name Строка
+     * \return true - строка является идентификатором
+     */
+    static bool IsIdentifier(const std::string& name)
+    {
+        if (name.empty() || (name[0] >= '0' && name[0] <= '9')) {
+            return false;
+        }
+        for (const char c : name) {
+            const bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            if (!letter && !(c >= '0' && c <= '9')) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Генерация массивов весов слоёв.
+     */
+    static void GenerateWeights(const NeuralNetwork& nn, std::ostream& code)
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            const Matrix& weights = nn.m_weights[layer];
+            if (weights.Rows() == 0) {
+                continue;
+            }
+            code << "// Веса слоя " << layer << ": строка - нейрон (фильтр), последний столбец - вес нейрона смещения\n"
+                 << "alignas(64) inline constexpr double Weights" << layer
+                 << "[" << weights.Rows() << "][" << weights.Cols() << "] = {\n";
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                code << "    { ";
+                for (std::size_t col = 0; col < weights.Cols(); col++) {
+                    code << (col == 0 ? "" : ", ") << weights[row][col];
+                }
+                code << " },\n";
+            }
+            code << "};\n\n";
+        }
+    }
+
+    /**
+     * Генерация функций активации.
+     */
+    static void GenerateActivations(std::ostream& code)
+    {
+        code << "namespace detail\n{\n\n"
+             << "inline double Sigmoid(const double x) { return 1.0 / (1.0 + std::exp(-x)); }\n"
+             << "inline double ReLU(const double x) { return x > 0.0 ? x : 0.0; }\n"
+             << "inline double LeakyReLU(const double x) { return x > 0.0 ? x : " << detail::LeakyReLUSlope << " * x; }\n"
+             << "inline double Tanh(const double x) { return std::tanh(x); }\n"
+             << "inline double Softplus(const double x) { return (x > 0.0 ? x : 0.0) + std::log1p(std::exp(-std::fabs(x))); }\n"
+             << "inline double GELU(const double x) { return 0.5 * x * (1.0 + std::erf(x * " << detail::InvSqrt2 << ")); }\n"
+             << "inline void Softmax(double* x, const std::size_t size)\n"
+             << "{\n"
+             << "    double max = x[0];\n"
+             << "    for (std::size_t i = 1; i < size; i++) {\n"
+             << "        max = x[i] > max ? x[i] : max;\n"
+             << "    }\n"
+             << "    double sum = 0.0;\n"
+             << "    for (std::size_t i = 0; i < size; i++) {\n"
+             << "        x[i] = std::exp(x[i] - max);\n"
+             << "        sum += x[i];\n"
+             << "    }\n"
+             << "    for (std::size_t i = 0; i < size; i++) {\n"
+             << "        x[i] /= sum;\n"
+             << "    }\n"
+             << "}\n\n"
+             << "}\n\n";
+    }
+
+    /**
+     * Получение выражения функции активации от взвешенной суммы.
+     * Для softmax возвращается сама сумма, функция применяется ко всему слою отдельно.
+     */
+    static std::string Activation(const ActivationFunction fn, const std::string& sum)
+    {
+        switch (fn) {
+        case ActivationFunction::Sigmoid:   return "detail::Sigmoid(" + sum + ")";
+        case ActivationFunction::ReLU:      return "detail::ReLU(" + sum + ")";
+        case ActivationFunction::LeakyReLU: return "detail::LeakyReLU(" + sum + ")";
+        case ActivationFunction::Tanh:      return "detail::Tanh(" + sum + ")";
+        case ActivationFunction::Softplus:  return "detail::Softplus(" + sum + ")";
+        case ActivationFunction::GELU:      return "detail::GELU(" + sum + ")";
+        default:                            return sum;
+        }
+    }
+
+    static void GenerateSoftmax(const NeuralNetwork& nn, const std::size_t layer, const std::string& destination, std::ostream& code)
+    {
+        if (nn.m_layers[layer].fn == ActivationFunction::Softmax) {
+            code << "    detail::Softmax(" << destination << ", " << nn.LayerShape(layer + 1).Size() << ");\n";
+        }
+    }
+
+    static void GenerateDense(
+        const NeuralNetwork& nn,
+        const std::size_t layer,
+        const std::string& source,
+        const std::string& destination,
+        std::ostream& code)
+    {
+        const Matrix& weights = nn.m_weights[layer];
+        const std::size_t inputs = weights.Cols() - 1;
+        code << "    // Слой " << layer << ": полносвязный, нейронов: " << weights.Rows() << ", входов: " << inputs << "\n"
+             << "    for (std::size_t row = 0; row < " << weights.Rows() << "; row++) {\n"
+             << "        double sum = Weights" << layer << "[row][" << inputs << "] * " << nn.m_layers[layer].bias << ";\n"
+             << "        for (std::size_t col = 0; col < " << inputs << "; col++) {\n"
+             << "            sum += Weights" << layer << "[row][col] * " << source << "[col];\n"
+             << "        }\n"
+             << "        " << destination << "[row] = " << Activation(nn.m_layers[layer].fn, "sum") << ";\n"
+             << "    }\n";
+        GenerateSoftmax(nn, layer, destination, code);
+    }
+
+    static void GenerateConvolution(
+        const NeuralNetwork& nn,
+        const std::size_t layer,
+        const std::string& source,
+        const std::string& destination,
+        std::ostream& code)
+    {
+        const Shape& in = nn.LayerShape(layer);
+        const Shape& out = nn.LayerShape(layer + 1);
+        const Window& window = nn.m_layers[layer].window;
+        const std::size_t kernel = in.channels * window.size * window.size;
+        code << "    // Слой " << layer << ": свёрточный, фильтров: " << out.channels << ", окно "
+             << window.size << "x" << window.size << ", шаг " << window.stride << ", дополнение " << window.padding << "\n"
+             << "    for (std::size_t f = 0; f < " << out.channels << "; f++) {\n"
+             << "        for (std::size_t oy = 0; oy < " << out.height << "; oy++) {\n"
+             << "            for (std::size_t ox = 0; ox < " << out.width << "; ox++) {\n"
+             << "                double sum = Weights" << layer << "[f][" << kernel << "] * " << nn.m_layers[layer].bias << ";\n"
+             << "                for (std::size_t c = 0; c < " << in.channels << "; c++) {\n"
+             << "                    for (std::size_t ky = 0; ky < " << window.size << "; ky++) {\n"
+             << "                        for (std::size_t kx = 0; kx < " << window.size << "; kx++) {\n";
+        const std::string indent = GenerateWindowElement(in, window, "                            ", code);
+        code << indent << "sum += Weights" << layer << "[f][(c * " << window.size << " + ky) * "
+             << window.size << " + kx] * " << source << "[(c * " << in.height << " + y) * " << in.width << " + x];\n";
+        CloseWindowElement(window, "                            ", code);
+        code << "                        }\n"
+             << "                    }\n"
+             << "                }\n"
+             << "                " << destination << "[(f * " << out.height << " + oy) * " << out.width << " + ox] = "
+             << Activation(nn.m_layers[layer].fn, "sum") << ";\n"
+             << "            }\n"
+             << "        }\n"
+             << "    }\n";
+        GenerateSoftmax(nn, layer, destination, code);
+    }
+
+    static void GenerateMaxPooling(
+        const NeuralNetwork& nn,
+        const std::size_t layer,
+        const std::string& source,
+        const std::string& destination,
+        std::ostream& code)
+    {
+        const Shape& in = nn.LayerShape(layer);
+        const Shape& out = nn.LayerShape(layer + 1);
+        const Window& window = nn.m_layers[layer].window;
+        code << "    // Слой " << layer << ": подвыборка по максимуму "
+             << window.size << "x" << window.size << ", шаг " << window.stride << "\n"
+             << "    for (std::size_t c = 0; c < " << out.channels << "; c++) {\n"
+             << "        for (std::size_t oy = 0; oy < " << out.height << "; oy++) {\n"
+             << "            for (std::size_t ox = 0; ox < " << out.width << "; ox++) {\n"
+             << "                double max = -HUGE_VAL;\n"
+             << "                for (std::size_t ky = 0; ky < " << window.size << "; ky++) {\n"
+             << "                    for (std::size_t kx = 0; kx < " << window.size << "; kx++) {\n";
+        const std::string indent = GenerateWindowElement(in, window, "                        ", code);
+        code << indent << "const double value = " << source << "[(c * " << in.height << " + y) * " << in.width << " + x];\n"
+             << indent << "max = value > max ? value : max;\n";
+        CloseWindowElement(window, "                        ", code);
+        code << "                    }\n"
+             << "                }\n"
+             << "                " << destination << "[(c * " << out.height << " + oy) * " << out.width << " + ox] = max;\n"
+             << "            }\n"
+             << "        }\n"
+             << "    }\n";
+    }
+
+    /**
+     * Генерация координат элемента входа под окном.
+     * Проверка выхода за край генерируется только при дополнении нулями.
+     *
+     * \return Отступ тела, использующего элемент
+     */
+    static std::string GenerateWindowElement(const Shape& in, const Window& window, const std::string& indent, std::ostream& code)
+    {
+        if (window.padding == 0) {
+            code << indent << "const std::size_t y = oy * " << window.stride << " + ky;\n"
+                 << indent << "const std::size_t x = ox * " << window.stride << " + kx;\n";
+            return indent;
+        }
+        code << indent << "const std::size_t y = oy * " << window.stride << " + ky - " << window.padding << ";\n"
+             << indent << "const std::size_t x = ox * " << window.stride << " + kx - " << window.padding << ";\n"
+             << indent << "// За краем входа - нули; отрицательные координаты переполняются и тоже отсекаются\n"
+             << indent << "if (y < " << in.height << " && x < " << in.width << ") {\n";
+        return indent + "    ";
+    }
+
+    static void CloseWindowElement(const Window& window, const std::string& indent, std::ostream& code)
+    {
+        if (window.padding != 0) {
+            code << indent << "}\n";
+        }
+    }
+};
+
+}
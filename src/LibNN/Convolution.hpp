@@ -0,0 +1,225 @@
+﻿#pragma once
+
+#include <limits>
+#include <stdexcept>
+
+#include "Matrix.hpp"
+
+namespace NN
+{
+
+/**
+ * Структура, описывающая форму данных слоя: каналы, высота, ширина.
+ * Данные хранятся в векторе построчно, канал за каналом.
+ */
+struct Shape
+{
+    // Количество каналов
+    std::size_t channels;
+    // Высота
+    std::size_t height;
+    // Ширина
+    std::size_t width;
+
+    /**
+     * Получение количества элементов.
+     *
+     * \return Количество элементов
+     */
+    std::size_t Size() const
+    {
+        return channels * height * width;
+    }
+};
+
+/**
+ * Структура, описывающая окно свёртки или подвыборки.
+ */
+struct Window
+{
+    // Размер квадратного окна
+    std::size_t size;
+    // Шаг окна
+    std::size_t stride;
+    // Дополнение нулями по краям
+    std::size_t padding;
+
+    /**
+     * Получение формы выхода окна для входа заданной формы.
+     *
+     * \param input Форма входа
+     * \param channels Количество каналов выхода
+     * \return Форма выхода
+     */
+    Shape Output(const Shape& input, const std::size_t channels) const noexcept(false)
+    {
+        if (size == 0 || stride == 0 || padding >= size
+            || input.height + 2 * padding < size || input.width + 2 * padding < size) {
+            throw std::invalid_argument("Window does not fit the input");
+        }
+        return {
+            channels,
+            (input.height + 2 * padding - size) / stride + 1,
+            (input.width + 2 * padding - size) / stride + 1
+        };
+    }
+};
+
+/**
+ * Развёртка входа свёрточного слоя в матрицу (im2col).
+ * Строка матрицы соответствует элементу окна (канал, строка окна, столбец окна),
+ * столбец - положению окна. Последняя строка заполнена значением нейрона смещения,
+ * поэтому свёртка сводится к умножению матрицы весов (фильтр, элемент окна + смещение)
+ * на полученную матрицу.
+ *
+ * \param input Вход слоя
+ * \param shape Форма входа
+ * \param window Окно свёртки
+ * \param bias Значение нейрона смещения
+ * \return Матрица размером (каналы * окно * окно + 1) x (количество положений окна)
+ */
+inline Matrix Im2Col(const Vector& input, const Shape& shape, const Window& window, const double bias)
+{
+    const Shape output = window.Output(shape, 1);
+    const std::size_t positions = output.height * output.width;
+    Matrix columns(shape.channels * window.size * window.size + 1, positions);
+    std::size_t row = 0;
+    for (std::size_t c = 0; c < shape.channels; c++) {
+        for (std::size_t ky = 0; ky < window.size; ky++) {
+            for (std::size_t kx = 0; kx < window.size; kx++, row++) {
+                double* column = columns[row].Data();
+                for (std::size_t oy = 0; oy < output.height; oy++) {
+                    // Координаты с учётом дополнения; за краем входа - нули
+                    const std::size_t y = oy * window.stride + ky;
+                    for (std::size_t ox = 0; ox < output.width; ox++) {
+                        const std::size_t x = ox * window.stride + kx;
+                        const bool inside = y >= window.padding && y < shape.height + window.padding
+                            && x >= window.padding && x < shape.width + window.padding;
+                        column[oy * output.width + ox] = inside
+                            ? input[(c * shape.height + y - window.padding) * shape.width + x - window.padding]
+                            : 0.0;
+                    }
+                }
+            }
+        }
+    }
+    columns[row] = bias;
+    return columns;
+}
+
+/**
+ * Свёртка матрицы обратно во вход (col2im), обратная операция к Im2Col.
+ * Значения, попавшие в один элемент входа из разных положений окна, суммируются.
+ * Строка нейрона смещения пропускается.
+ *
+ * \param columns Матрица, полученная так же, как в Im2Col
+ * \param shape Форма входа
+ * \param window Окно свёртки
+ * \return Вектор формы входа
+ */
+inline Vector Col2Im(const Matrix& columns, const Shape& shape, const Window& window)
+{
+    const Shape output = window.Output(shape, 1);
+    Vector result(shape.Size());
+    result = 0.0;
+    std::size_t row = 0;
+    for (std::size_t c = 0; c < shape.channels; c++) {
+        for (std::size_t ky = 0; ky < window.size; ky++) {
+            for (std::size_t kx = 0; kx < window.size; kx++, row++) {
+                const double* column = columns[row].Data();
+                for (std::size_t oy = 0; oy < output.height; oy++) {
+                    const std::size_t y = oy * window.stride + ky;
+                    if (y < window.padding || y >= shape.height + window.padding) {
+                        continue;
+                    }
+                    for (std::size_t ox = 0; ox < output.width; ox++) {
+                        const std::size_t x = ox * window.stride + kx;
+                        if (x >= window.padding && x < shape.width + window.padding) {
+                            result[(c * shape.height + y - window.padding) * shape.width + x - window.padding]
+                                += column[oy * output.width + ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Подвыборка по максимуму.
+ *
+ * \param input Вход слоя
+ * \param shape Форма входа
+ * \param window Окно подвыборки
+ * \return Выход слоя
+ */
+inline Vector MaxPool(const Vector& input, const Shape& shape, const Window& window)
+{
+    const Shape output = window.Output(shape, shape.channels);
+    Vector result(output.Size());
+    for (std::size_t c = 0; c < shape.channels; c++) {
+        for (std::size_t oy = 0; oy < output.height; oy++) {
+            for (std::size_t ox = 0; ox < output.width; ox++) {
+                double max = -std::numeric_limits<double>::infinity();
+                for (std::size_t ky = 0; ky < window.size; ky++) {
+                    const std::size_t y = oy * window.stride + ky;
+                    for (std::size_t kx = 0; kx < window.size; kx++) {
+                        const std::size_t x = ox * window.stride + kx;
+                        // Дополнение не участвует в выборе максимума
+                        if (y >= window.padding && y < shape.height + window.padding
+                            && x >= window.padding && x < shape.width + window.padding) {
+                            const double value = input[(c * shape.height + y - window.padding) * shape.width + x - window.padding];
+                            max = value > max ? value : max;
+                        }
+                    }
+                }
+                result[(c * output.height + oy) * output.width + ox] = max;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Обратный проход подвыборки по максимуму.
+ * Градиент выхода передаётся тому элементу входа, на котором был достигнут максимум.
+ *
+ * \param input Вход слоя при прямом проходе
+ * \param gradient Градиент по выходу слоя
+ * \param shape Форма входа
+ * \param window Окно подвыборки
+ * \return Градиент по входу слоя
+ */
+inline Vector MaxPoolBackward(const Vector& input, const Vector& gradient, const Shape& shape, const Window& window)
+{
+    const Shape output = window.Output(shape, shape.channels);
+    Vector result(shape.Size());
+    result = 0.0;
+    for (std::size_t c = 0; c < shape.channels; c++) {
+        for (std::size_t oy = 0; oy < output.height; oy++) {
+            for (std::size_t ox = 0; ox < output.width; ox++) {
+                double max = -std::numeric_limits<double>::infinity();
+                std::size_t argmax = 0;
+                for (std::size_t ky = 0; ky < window.size; ky++) {
+                    const std::size_t y = oy * window.stride + ky;
+                    for (std::size_t kx = 0; kx < window.size; kx++) {
+                        const std::size_t x = ox * window.stride + kx;
+                        if (y >= window.padding && y < shape.height + window.padding
+                            && x >= window.padding && x < shape.width + window.padding) {
+                            const std::size_t index = (c * shape.height + y - window.padding) * shape.width + x - window.padding;
+                            if (input[index] > max) {
+                                max = input[index];
+                                argmax = index;
+                            }
+                        }
+                    }
+                }
+                result[argmax] += gradient[(c * output.height + oy) * output.width + ox];
+            }
+        }
+    }
+    return result;
+}
+
+}
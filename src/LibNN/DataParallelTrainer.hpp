@@ -0,0 +1,400 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "NeuralNetwork.hpp"
+#include "NeuralNetworkTrainer.hpp"
+
+namespace NN
+{
+
+/**
+ * Способ обмена весами между процессами.
+ */
+enum class DataParallelMode
+{
+    AllReduce,          // Синхронное усреднение весов всеми процессами
+    ParameterServer     // Асинхронная отправка изменений весов в общую копию
+};
+
+/**
+ * Структура, описывающая результат обучения.
+ */
+struct DataParallelReport
+{
+    // Количество процессов
+    std::size_t workers;
+    // Общее количество обучающих примеров, обработанных всеми процессами
+    std::size_t samples;
+    // Время обучения в секундах, включая запуск процессов
+    double seconds;
+    // Средняя ошибка на последнем интервале синхронизации
+    double error;
+
+    /**
+     * Получение пропускной способности.
+     *
+     * \return Количество обучающих примеров в секунду
+     */
+    double SamplesPerSecond() const
+    {
+        return seconds > 0.0 ? samples / seconds : 0.0;
+    }
+};
+
+/**
+ * Класс, реализующий обучение нейронной сети несколькими процессами
+ * с разделением данных (только POSIX).
+ * Каждый процесс обучает свою копию сети на своей части обучающих данных
+ * обычным NeuralNetworkTrainer и через заданное количество шагов
+ * обменивается весами с остальными через общую память:
+ * - AllReduce: процессы записывают веса в свои слоты, каждый усредняет
+ *   свой участок весов всех слотов в общую копию, после чего все забирают её;
+ * - ParameterServer: процесс под блокировкой добавляет к общей копии
+ *   своё изменение весов, делённое на количество процессов, и забирает её,
+ *   не дожидаясь остальных.
+ * Отдельные процессы не делят между собой кучу и распределитель памяти
+ * и могут работать на разных процессорах (узлах NUMA).
+ * В процессе, созданном fork, существует только поток, вызвавший Train,
+ * поэтому процессы обучают сеть однопоточными ядрами умножения.
+ * Вызывать Train, пока в процессе работают другие потоки (Telemetry, Validator,
+ * PipelineTrainer), небезопасно: захваченные ими блокировки в процессах
+ * останутся захваченными навсегда.
+ */
+class DataParallelTrainer
+{
+    // Заголовок общей памяти. Атомарные переменные без блокировок
+    // корректно работают в памяти, разделяемой процессами
+    struct Header
+    {
+        // Количество процессов, дошедших до барьера
+        alignas(64) std::atomic<std::uint32_t> arrived;
+        // Фаза барьера, меняется на противоположную при каждом прохождении
+        alignas(64) std::atomic<std::uint32_t> sense;
+        // Блокировка общей копии весов в режиме ParameterServer
+        alignas(64) std::atomic<std::uint32_t> lock;
+    };
+    static_assert(std::atomic<std::uint32_t>::is_always_lock_free,
+        "Shared memory synchronization requires lock-free atomics");
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть для обучения
+     * \param workers Количество процессов
+     * \param learningRate Скорость обучения
+     * \param momentum Момент
+     * \param loss Функция потерь
+     */
+    DataParallelTrainer(
+        NeuralNetwork& nn,
+        const std::size_t workers,
+        const double learningRate,
+        const double momentum,
+        const LossFunction loss = LossFunction::MeanSquaredError) noexcept(false):
+        m_nn(nn),
+        m_workers(workers),
+        m_learningRate(learningRate),
+        m_momentum(momentum),
+        m_loss(loss),
+        m_mode(DataParallelMode::AllReduce),
+        m_syncInterval(100)
+    {
+        if (m_workers == 0) {
+            throw std::invalid_argument("Number of workers must be non-zero");
+        }
+        // Проверяем параметры обучения до запуска процессов
+        NeuralNetworkTrainer check(nn, learningRate, momentum, loss);
+        (void)check;
+    }
+    /**
+     * Установка способа обмена весами.
+     *
+     * \param mode Способ обмена весами
+     */
+    void SetMode(const DataParallelMode mode)
+    {
+        m_mode = mode;
+    }
+    /**
+     * Установка интервала синхронизации.
+     *
+     * \param steps Количество шагов обучения каждого процесса между обменами весами
+     */
+    void SetSyncInterval(const std::size_t steps) noexcept(false)
+    {
+        if (steps == 0) {
+            throw std::invalid_argument("Sync interval must be non-zero");
+        }
+        m_syncInterval = steps;
+    }
+    /**
+     * Обучение нейронной сети.
+     * Обучающие примеры распределяются по процессам по остатку от деления
+     * номера на количество процессов, каждый процесс выбирает примеры
+     * из своей части случайно. По завершении веса сети заменяются общей копией.
+     *
+     * \param inputs Массив векторов входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \param samples Общее количество шагов обучения всех процессов
+     * \param seed Начальное значение генераторов случайных чисел процессов
+     * \return Результат обучения
+     */
+    DataParallelReport Train(
+        const std::vector<Vector>& inputs,
+        const std::vector<Vector>& outputs,
+        const std::size_t samples,
+        const std::uint32_t seed = 1) noexcept(false)
+    {
+        if (inputs.size() != outputs.size() || inputs.size() < m_workers) {
+            throw std::invalid_argument("Each worker needs at least one training sample");
+        }
+        const std::size_t steps = samples / m_workers;
+        const std::size_t parameters = m_nn.ParametersCount();
+        // Общая память: заголовок, общая копия весов, слоты весов процессов, ошибки процессов.
+        // Отображение наследуется процессами, созданными fork
+        const std::size_t size = sizeof(Header) + (parameters * (m_workers + 1) + m_workers) * sizeof(double);
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            throw std::runtime_error("Failed to map shared memory");
+        }
+        Header* header = new (memory) Header{};
+        double* master = reinterpret_cast<double*>(static_cast<char*>(memory) + sizeof(Header));
+        double* slots = master + parameters;
+        double* errors = slots + parameters * m_workers;
+        m_nn.GetParameters(master);
+
+        const auto start = std::chrono::steady_clock::now();
+        // Иначе буферизованный вывод родителя будет выведен каждым процессом повторно
+        std::fflush(nullptr);
+        std::vector<pid_t> children;
+        for (std::size_t worker = 0; worker < m_workers; worker++) {
+            const pid_t pid = fork();
+            if (pid == 0) {
+                int status = 0;
+                try {
+                    Worker(worker, steps, seed, inputs, outputs, *header, master, slots, errors);
+                }
+                catch (...) {
+                    status = 1;
+                }
+                // Процесс завершается без вызова деструкторов и обработчиков родителя
+                _exit(status);
+            }
+            if (pid < 0) {
+                // Уже запущенные процессы не дождутся остальных на барьере
+                for (const pid_t child : children) {
+                    kill(child, SIGKILL);
+                    waitpid(child, nullptr, 0);
+                }
+                munmap(memory, size);
+                throw std::runtime_error("Failed to start worker process");
+            }
+            children.push_back(pid);
+        }
+        // Ждём завершения процессов. Если один из них завершился с ошибкой,
+        // остальные не дождутся его на барьере, поэтому завершаем их принудительно
+        bool failed = false;
+        for (std::size_t running = children.size(); running > 0;) {
+            for (pid_t& child : children) {
+                int status = 0;
+                const pid_t result = child == 0 ? 0 : waitpid(child, &status, WNOHANG);
+                if (result == 0) {
+                    continue;
+                }
+                if ((result < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) && !failed) {
+                    failed = true;
+                    for (const pid_t other : children) {
+                        if (other != 0 && other != child) {
+                            kill(other, SIGKILL);
+                        }
+                    }
+                }
+                child = 0;
+                running--;
+            }
+            if (running > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        DataParallelReport report = {
+            m_workers,
+            steps * m_workers,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(),
+            0.0
+        };
+        if (!failed) {
+            m_nn.SetParameters(master);
+            for (std::size_t worker = 0; worker < m_workers; worker++) {
+                report.error += errors[worker] / m_workers;
+            }
+        }
+        munmap(memory, size);
+        if (failed) {
+            throw std::runtime_error("Worker process failed");
+        }
+        return report;
+    }
+private:
+    // Ссылка на нейронную сеть
+    NeuralNetwork& m_nn;
+    // Количество процессов
+    std::size_t m_workers;
+    // Скорость обучения
+    double m_learningRate;
+    // Момент
+    double m_momentum;
+    // Функция потерь
+    LossFunction m_loss;
+    // Способ обмена весами
+    DataParallelMode m_mode;
+    // Количество шагов обучения между обменами весами
+    std::size_t m_syncInterval;
+
+    /**
+     * Обучение в процессе.
+     *
+     * \param worker Номер процесса
+     * \param steps Количество шагов обучения
+     * \param seed Начальное значение генератора случайных чисел
+     * \param inputs Массив векторов входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \param header Заголовок общей памяти
+     * \param master Общая копия весов
+     * \param slots Слоты весов процессов
+     * \param errors Ошибки процессов
+     */
+    void Worker(
+        const std::size_t worker,
+        const std::size_t steps,
+        const std::uint32_t seed,
+        const std::vector<Vector>& inputs,
+        const std::vector<Vector>& outputs,
+        Header& header,
+        double* master,
+        double* slots,
+        double* errors)
+    {
+        // Копия сети процесса. Память родителя после fork принадлежит процессу.
+        // Потоков пула умножения в процессе нет, поэтому ядра делаем однопоточными
+        for (GemvConfig& kernel : m_nn.m_kernels) {
+            kernel.threads = 1;
+        }
+        NeuralNetworkTrainer trainer(m_nn, m_learningRate, m_momentum, m_loss);
+        const std::size_t parameters = m_nn.ParametersCount();
+        double* slot = slots + parameters * worker;
+        // В режиме ParameterServer слот хранит веса, полученные при последнем обмене
+        m_nn.GetParameters(slot);
+        // Часть обучающих данных процесса: номера с остатком worker
+        const std::size_t shard = (inputs.size() - worker + m_workers - 1) / m_workers;
+        std::mt19937 rng(seed + static_cast<std::uint32_t>(worker));
+        std::uniform_int_distribution<std::size_t> ds(0, shard - 1);
+        std::vector<double> local(parameters);
+        // Локальная фаза барьера
+        std::uint32_t sense = 0;
+        double error = 0.0;
+        std::size_t count = 0;
+        for (std::size_t step = 1; step <= steps; step++) {
+            const std::size_t index = ds(rng) * m_workers + worker;
+            error += trainer.Train(inputs[index], outputs[index]);
+            count++;
+            if (step % m_syncInterval == 0 || step == steps) {
+                errors[worker] = error / count;
+                error = 0.0;
+                count = 0;
+                if (m_mode == DataParallelMode::AllReduce) {
+                    AllReduce(worker, header, sense, master, slots);
+                }
+                else {
+                    PushPull(header, master, slot, local.data());
+                }
+            }
+        }
+    }
+
+    /**
+     * Синхронное усреднение весов.
+     * Каждый процесс усредняет свой участок весов, поэтому работа
+     * и обращения к памяти распределяются между процессами поровну.
+     */
+    void AllReduce(const std::size_t worker, Header& header, std::uint32_t& sense, double* master, double* slots)
+    {
+        const std::size_t parameters = m_nn.ParametersCount();
+        m_nn.GetParameters(slots + parameters * worker);
+        Barrier(header, sense);
+        const std::size_t begin = parameters * worker / m_workers;
+        const std::size_t end = parameters * (worker + 1) / m_workers;
+        const double scale = 1.0 / m_workers;
+        for (std::size_t i = begin; i < end; i++) {
+            double sum = 0.0;
+            for (std::size_t w = 0; w < m_workers; w++) {
+                sum += slots[parameters * w + i];
+            }
+            master[i] = sum * scale;
+        }
+        Barrier(header, sense);
+        m_nn.SetParameters(master);
+    }
+
+    /**
+     * Отправка изменения весов в общую копию и получение общей копии.
+     *
+     * \param header Заголовок общей памяти
+     * \param master Общая копия весов
+     * \param base Веса, полученные при последнем обмене
+     * \param local Буфер для текущих весов процесса
+     */
+    void PushPull(Header& header, double* master, double* base, double* local)
+    {
+        const std::size_t parameters = m_nn.ParametersCount();
+        const double scale = 1.0 / m_workers;
+        m_nn.GetParameters(local);
+        while (header.lock.exchange(1, std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+        for (std::size_t i = 0; i < parameters; i++) {
+            master[i] += (local[i] - base[i]) * scale;
+            base[i] = master[i];
+        }
+        header.lock.store(0, std::memory_order_release);
+        m_nn.SetParameters(base);
+    }
+
+    /**
+     * Барьер с обращением фазы: последний пришедший процесс сбрасывает счётчик
+     * и меняет фазу, остальные ждут смены фазы.
+     *
+     * \param header Заголовок общей памяти
+     * \param sense Локальная фаза процесса
+     */
+    void Barrier(Header& header, std::uint32_t& sense)
+    {
+        sense ^= 1;
+        if (header.arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_workers) {
+            header.arrived.store(0, std::memory_order_relaxed);
+            header.sense.store(sense, std::memory_order_release);
+        }
+        else {
+            // Процессов может быть больше, чем процессоров,
+            // поэтому ожидающий процесс уступает процессор
+            while (header.sense.load(std::memory_order_acquire) != sense) {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+}
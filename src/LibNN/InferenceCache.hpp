@@ -0,0 +1,258 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+/**
+ * Структура, описывающая статистику кэша результатов.
+ */
+struct InferenceCacheStats
+{
+    // Количество попаданий
+    std::uint64_t hits;
+    // Количество промахов, включая устаревшие записи
+    std::uint64_t misses;
+    // Количество вытесненных записей
+    std::uint64_t evictions;
+    // Количество записей в кэше
+    std::size_t entries;
+
+    /**
+     * Получение доли попаданий.
+     *
+     * \return Доля попаданий среди всех обращений
+     */
+    double HitRate() const
+    {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+    }
+    /**
+     * Получение доли промахов.
+     *
+     * \return Доля промахов среди всех обращений
+     */
+    double MissRate() const
+    {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(misses) / (hits + misses);
+    }
+};
+
+/**
+ * Класс, реализующий кэш результатов прямого прохода для повторяющихся входов.
+ * Ключ - хэш входного вектора, при совпадении хэша вход сравнивается полностью.
+ * Кэш разделён на сегменты со своими блокировками, сегмент выбирается по хэшу,
+ * поэтому потоки с разными входами почти не конкурируют.
+ * Объём кэша ограничен, при заполнении сегмента запись вытесняется алгоритмом CLOCK:
+ * стрелка обходит записи по кругу, снимая признак обращения,
+ * и вытесняет первую запись без него.
+ * Каждая запись хранит номер версии весов сети, для которой вычислена.
+ * После любого изменения весов записи с прежним номером считаются промахом
+ * и пересчитываются, поэтому явно очищать кэш не нужно.
+ * Прямой проход при промахе выполняется без блокировок.
+ * Изменять сеть одновременно с обращениями к кэшу нельзя, как и при вызове NeuralNetwork::Forward.
+ */
+class InferenceCache
+{
+    // Запись кэша
+    struct Entry
+    {
+        // Хэш входа
+        std::uint64_t hash;
+        // Номер версии весов сети
+        std::uint64_t version;
+        // Вход и выход сети
+        Vector input;
+        Vector output;
+        // Признак обращения (CLOCK)
+        bool referenced;
+    };
+    // Сегмент кэша
+    struct Shard
+    {
+        std::mutex mutex;
+        // Записи, не больше capacity
+        std::vector<Entry> entries;
+        // Номер записи по хэшу входа
+        std::unordered_map<std::uint64_t, std::size_t> index;
+        // Стрелка CLOCK
+        std::size_t hand = 0;
+        // Статистика
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+    };
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть
+     * \param memory Ограничение объёма входов и выходов в кэше, байт
+     * \param shards Количество сегментов, округляется вверх до степени двойки
+     */
+    explicit InferenceCache(const NeuralNetwork& nn, const std::size_t memory = 16 << 20, const std::size_t shards = 16) noexcept(false):
+        m_nn(nn),
+        m_shardBits(0)
+    {
+        while ((std::size_t(1) << m_shardBits) < shards) {
+            m_shardBits++;
+        }
+        m_shards = std::vector<Shard>(std::size_t(1) << m_shardBits);
+        const std::size_t entrySize = sizeof(Entry)
+            + (nn.LayerShape(0).Size() + nn.LayerShape(nn.LayersCount()).Size()) * sizeof(double);
+        m_capacity = memory / entrySize / m_shards.size();
+        if (m_capacity == 0) {
+            throw std::invalid_argument("Cache memory is too small for one entry per shard");
+        }
+    }
+    InferenceCache(const InferenceCache&) = delete;
+    InferenceCache& operator = (const InferenceCache&) = delete;
+    /**
+     * Прямой проход по нейронной сети с использованием кэша
+     *
+     * \param input Вектор входных данных
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const Vector& input)
+    {
+        const std::uint64_t hash = Hash(input);
+        const std::uint64_t version = m_nn.Version();
+        Shard& shard = m_shards[m_shardBits == 0 ? 0 : hash >> (64 - m_shardBits)];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const auto it = shard.index.find(hash);
+            if (it != shard.index.end()) {
+                Entry& entry = shard.entries[it->second];
+                if (entry.version == version && Equal(entry.input, input)) {
+                    entry.referenced = true;
+                    shard.hits++;
+                    return entry.output;
+                }
+            }
+            shard.misses++;
+        }
+        Vector output = m_nn.Forward(input);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            Insert(shard, hash, version, input, output);
+        }
+        return output;
+    }
+    /**
+     * Получение статистики.
+     *
+     * \return Статистика по всем сегментам
+     */
+    InferenceCacheStats Stats() const
+    {
+        InferenceCacheStats stats{ 0, 0, 0, 0 };
+        for (auto& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            stats.hits += shard.hits;
+            stats.misses += shard.misses;
+            stats.evictions += shard.evictions;
+            stats.entries += shard.entries.size();
+        }
+        return stats;
+    }
+    /**
+     * Удаление всех записей и сброс статистики.
+     */
+    void Clear()
+    {
+        for (auto& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.entries.clear();
+            shard.index.clear();
+            shard.hand = 0;
+            shard.hits = 0;
+            shard.misses = 0;
+            shard.evictions = 0;
+        }
+    }
+    /**
+     * Получение максимального количества записей.
+     *
+     * \return Количество записей во всех сегментах
+     */
+    std::size_t Capacity() const
+    {
+        return m_capacity * m_shards.size();
+    }
+private:
+    // Нейронная сеть
+    const NeuralNetwork& m_nn;
+    // Количество бит хэша, выбирающих сегмент
+    unsigned m_shardBits;
+    // Сегменты
+    mutable std::vector<Shard> m_shards;
+    // Количество записей в сегменте
+    std::size_t m_capacity;
+
+    /**
+     * Вставка или обновление записи. Вызывается под блокировкой сегмента.
+     */
+    void Insert(Shard& shard, const std::uint64_t hash, const std::uint64_t version, const Vector& input, const Vector& output)
+    {
+        const auto it = shard.index.find(hash);
+        if (it != shard.index.end()) {
+            // Устаревшая запись для того же входа либо вход с тем же хэшем - заменяем
+            shard.entries[it->second] = { hash, version, input, output, false };
+            return;
+        }
+        if (shard.entries.size() < m_capacity) {
+            shard.index.emplace(hash, shard.entries.size());
+            shard.entries.push_back({ hash, version, input, output, false });
+            return;
+        }
+        // Стрелка пропускает записи с признаком обращения, снимая его
+        while (shard.entries[shard.hand].referenced) {
+            shard.entries[shard.hand].referenced = false;
+            shard.hand = (shard.hand + 1) % shard.entries.size();
+        }
+        Entry& victim = shard.entries[shard.hand];
+        shard.index.erase(victim.hash);
+        shard.index.emplace(hash, shard.hand);
+        victim = { hash, version, input, output, false };
+        shard.hand = (shard.hand + 1) % shard.entries.size();
+        shard.evictions++;
+    }
+
+    /**
+     * Хэш входного вектора: перемешивание 64-битных представлений элементов.
+     * Старшие биты выбирают сегмент, поэтому результат дополнительно перемешивается.
+     *
+     * \param input Вектор
+     * \return Хэш
+     */
+    static std::uint64_t Hash(const Vector& input)
+    {
+        std::uint64_t hash = 0x9E3779B97F4A7C15ull ^ input.Size();
+        for (std::size_t i = 0; i < input.Size(); i++) {
+            std::uint64_t bits;
+            std::memcpy(&bits, input.Data() + i, sizeof(bits));
+            hash = (hash ^ bits) * 0xBF58476D1CE4E5B9ull;
+            hash ^= hash >> 31;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    static bool Equal(const Vector& a, const Vector& b)
+    {
+        return a.Size() == b.Size() && std::memcmp(a.Data(), b.Data(), a.Size() * sizeof(double)) == 0;
+    }
+};
+
+}
@@ -0,0 +1,386 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+
+// Генерация машинного кода поддерживается для x86-64 с соглашением о вызовах System V
+#if defined(__x86_64__) && defined(__unix__)
+#   define NN_JIT_X86_64 1
+#   include <sys/mman.h>
+#endif
+
+namespace NN
+{
+
+namespace detail{
+
+    /**
+     * Класс, реализующий запись машинного кода x86-64 (SSE2) в буфер.
+     * Поддерживается только набор инструкций, нужный для умножения матрицы на вектор.
+     */
+    class X64Emitter
+    {
+    public:
+        // Регистры общего назначения
+        enum Register : std::uint8_t { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11 };
+        // Коды операций SSE2 (после префикса и 0x0F)
+        enum Sse : std::uint8_t
+        {
+            Load = 0x10,    // movupd / movsd xmm, m
+            Store = 0x11,   // movsd m, xmm
+            Unpckh = 0x15,  // unpckhpd
+            Move = 0x28,    // movapd xmm, xmm
+            Xor = 0x57,     // xorpd
+            Add = 0x58,     // addpd / addsd
+            Mul = 0x59,     // mulpd / mulsd
+            Max = 0x5F      // maxsd
+        };
+        // Префиксы: упакованные (pd) и скалярные (sd) операции
+        static constexpr std::uint8_t Packed = 0x66;
+        static constexpr std::uint8_t Scalar = 0xF2;
+
+        const std::vector<std::uint8_t>& Code() const
+        {
+            return m_code;
+        }
+        std::size_t Position() const
+        {
+            return m_code.size();
+        }
+        // mov reg, imm64
+        void MovImm64(const Register reg, const void* value)
+        {
+            Byte(0x48 | (reg >> 3));
+            Byte(0xB8 + (reg & 7));
+            const auto imm = reinterpret_cast<std::uint64_t>(value);
+            for (int i = 0; i < 8; i++) {
+                Byte(static_cast<std::uint8_t>(imm >> (8 * i)));
+            }
+        }
+        // mov reg, imm32 (со знаковым расширением)
+        void MovImm32(const Register reg, const std::int32_t value)
+        {
+            Byte(0x48 | (reg >> 3));
+            Byte(0xC7);
+            Byte(0xC0 | (reg & 7));
+            Imm32(value);
+        }
+        // mov dst, src
+        void Mov(const Register dst, const Register src)
+        {
+            Byte(0x48 | ((src >> 3) << 2) | (dst >> 3));
+            Byte(0x89);
+            Byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+        }
+        // add reg, imm32
+        void AddImm32(const Register reg, const std::int32_t value)
+        {
+            Byte(0x48 | (reg >> 3));
+            Byte(0x81);
+            Byte(0xC0 | (reg & 7));
+            Imm32(value);
+        }
+        // dec reg
+        void Dec(const Register reg)
+        {
+            Byte(0x48 | (reg >> 3));
+            Byte(0xFF);
+            Byte(0xC8 | (reg & 7));
+        }
+        // jnz target
+        void Jnz(const std::size_t target)
+        {
+            Byte(0x0F);
+            Byte(0x85);
+            Imm32(static_cast<std::int32_t>(static_cast<std::int64_t>(target) - static_cast<std::int64_t>(Position() + 4)));
+        }
+        // ret
+        void Ret()
+        {
+            Byte(0xC3);
+        }
+        // Операция SSE над регистрами xmm0 - xmm7: op dst, src
+        void Op(const std::uint8_t prefix, const Sse op, const std::uint8_t dst, const std::uint8_t src)
+        {
+            Byte(prefix);
+            Byte(0x0F);
+            Byte(op);
+            Byte(0xC0 | (dst << 3) | src);
+        }
+        // Операция SSE с памятью: op xmm, [base + disp] (для Store - op [base + disp], xmm)
+        void OpMem(const std::uint8_t prefix, const Sse op, const std::uint8_t xmm, const Register base, const std::int32_t disp)
+        {
+            Byte(prefix);
+            if (base >> 3) {
+                Byte(0x41);
+            }
+            Byte(0x0F);
+            Byte(op);
+            Byte(0x80 | (xmm << 3) | (base & 7));
+            Imm32(disp);
+        }
+    private:
+        std::vector<std::uint8_t> m_code;
+
+        void Byte(const int value)
+        {
+            m_code.push_back(static_cast<std::uint8_t>(value));
+        }
+        void Imm32(const std::int32_t value)
+        {
+            const auto imm = static_cast<std::uint32_t>(value);
+            for (int i = 0; i < 4; i++) {
+                Byte(static_cast<std::uint8_t>(imm >> (8 * i)));
+            }
+        }
+    };
+
+}
+
+/**
+ * Класс, реализующий прямой проход нейронной сети с машинным кодом,
+ * сгенерированным во время выполнения (JIT) для каждого полносвязного слоя.
+ * Код умножения матрицы весов на вектор специализирован под размеры слоя:
+ * строки обрабатываются блоками по 4 (по аккумулятору SSE2 на строку),
+ * столбцы - парами, количество итераций - константы, остатки по строкам
+ * и столбцам обрабатываются отдельным кодом без ветвлений.
+ * Смещение прибавляется и ReLU / LeakyReLU вычисляется в том же коде,
+ * остальные функции активации применяются после него.
+ * Код размещается в анонимных страницах, которые после записи
+ * переключаются с записи на исполнение.
+ * Если генерация недоступна (не x86-64, отключена или запрещена системой),
+ * слой выполняется переносимыми ядрами NeuralNetwork.
+ */
+class JitNeuralNetwork
+{
+    // Сгенерированная функция: input - вход слоя, output - выход слоя
+    using Function = void (*)(const double* input, double* output);
+    // Слой со сгенерированным кодом
+    struct Layer
+    {
+        // Веса без весов нейрона смещения, строка за строкой
+        std::vector<double> weights;
+        // Вес нейрона смещения, умноженный на значение нейрона смещения
+        std::vector<double> biases;
+        // Наклон LeakyReLU
+        double slope;
+        // Исполняемая память
+        void* memory;
+        std::size_t size;
+        // Точка входа
+        Function function;
+        // Функция активации вычислена в сгенерированном коде
+        bool fused;
+    };
+public:
+    /**
+     * Конструктор. Генерирует код для полносвязных слоёв.
+     *
+     * \param nn Нейронная сеть
+     * \param enabled false - генерация отключена, все слои выполняются переносимыми ядрами
+     */
+    explicit JitNeuralNetwork(const NeuralNetwork& nn, const bool enabled = true):
+        m_network(nn),
+        m_layers(nn.LayersCount())
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            m_layers[layer] = { {}, {}, detail::LeakyReLUSlope, nullptr, 0, nullptr, false };
+            if (enabled && Available() && nn.m_layers[layer].type == LayerType::Dense) {
+                Compile(layer);
+            }
+        }
+    }
+    JitNeuralNetwork(const JitNeuralNetwork&) = delete;
+    JitNeuralNetwork& operator = (const JitNeuralNetwork&) = delete;
+    ~JitNeuralNetwork()
+    {
+#if defined(NN_JIT_X86_64)
+        for (auto& layer : m_layers) {
+            if (layer.memory != nullptr) {
+                munmap(layer.memory, layer.size);
+            }
+        }
+#endif
+    }
+    /**
+     * Проверка поддержки генерации кода на текущей платформе.
+     *
+     * \return true, если поддерживается
+     */
+    static bool Available()
+    {
+#if defined(NN_JIT_X86_64)
+        return true;
+#else
+        return false;
+#endif
+    }
+    /**
+     * Проверка, выполняется ли слой сгенерированным кодом.
+     *
+     * \param layer Номер слоя
+     * \return true, если для слоя сгенерирован код
+     */
+    bool Compiled(const std::size_t layer) const
+    {
+        return m_layers[layer].function != nullptr;
+    }
+    /**
+     * Прямой проход по нейронной сети
+     *
+     * \param input Вектор входных данных
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const Vector& input) const noexcept(false)
+    {
+        if (input.Size() != m_network.LayerShape(0).Size()) {
+            throw std::out_of_range("Input size must be equal to the number of network inputs");
+        }
+        Vector output = input;
+        for (std::size_t layer = 0; layer < m_layers.size(); layer++) {
+            const Layer& compiled = m_layers[layer];
+            if (compiled.function == nullptr) {
+                output = m_network.Forward(output, layer);
+                continue;
+            }
+            Vector result(compiled.biases.size());
+            compiled.function(output.Data(), result.Data());
+            if (!compiled.fused) {
+                NN::Activate(m_network.m_layers[layer].fn, m_network.m_accuracy, result.Data(), result.Data(), result.Size());
+            }
+            output = std::move(result);
+        }
+        return output;
+    }
+private:
+    // Нейронная сеть для слоёв без сгенерированного кода
+    NeuralNetwork m_network;
+    // Слои
+    std::vector<Layer> m_layers;
+
+    /**
+     * Генерация кода слоя.
+     * Регистры: rdi - вход, rsi - выход, rax - веса блока строк, rdx - смещения,
+     * rcx - счётчик блоков, r9 / r10 - текущие столбцы входа и весов,
+     * r11 - счётчик пар столбцов, r8 - наклон LeakyReLU;
+     * xmm0 - xmm3 - аккумуляторы строк, xmm4 - пара входов, xmm5 - временный, xmm6 - ноль.
+     *
+     * \param layer Номер слоя
+     */
+    void Compile(const std::size_t layer)
+    {
+#if defined(NN_JIT_X86_64)
+        using E = detail::X64Emitter;
+        const Matrix& weights = m_network.m_weights[layer];
+        const std::size_t rows = weights.Rows();
+        const std::size_t cols = weights.Cols() - 1;
+        const std::size_t stride = cols * sizeof(double);
+        // Смещения строк блока кодируются 32-битными константами
+        if (rows == 0 || stride * 4 > static_cast<std::size_t>(std::numeric_limits<std::int32_t>::max())) {
+            return;
+        }
+        Layer& compiled = m_layers[layer];
+        compiled.weights.resize(rows * cols);
+        compiled.biases.resize(rows);
+        for (std::size_t row = 0; row < rows; row++) {
+            std::copy(weights[row].Data(), weights[row].Data() + cols, compiled.weights.data() + row * cols);
+            compiled.biases[row] = weights[row][cols] * m_network.m_layers[layer].bias;
+        }
+        const ActivationFunction fn = m_network.m_layers[layer].fn;
+        compiled.fused = fn == ActivationFunction::ReLU || fn == ActivationFunction::LeakyReLU;
+
+        E e;
+        e.MovImm64(E::RAX, compiled.weights.data());
+        e.MovImm64(E::RDX, compiled.biases.data());
+        e.MovImm64(E::R8, &compiled.slope);
+        e.Op(E::Packed, E::Xor, 6, 6);
+        // Блок из count строк: аккумуляторы, проход по парам столбцов,
+        // сложение половин, остаток по столбцам, смещение, активация, запись
+        auto block = [&](const std::size_t count) {
+            for (std::uint8_t r = 0; r < count; r++) {
+                e.Op(E::Packed, E::Xor, r, r);
+            }
+            e.Mov(E::R9, E::RDI);
+            e.Mov(E::R10, E::RAX);
+            if (cols / 2 > 0) {
+                e.MovImm32(E::R11, static_cast<std::int32_t>(cols / 2));
+                const std::size_t loop = e.Position();
+                e.OpMem(E::Packed, E::Load, 4, E::R9, 0);
+                for (std::uint8_t r = 0; r < count; r++) {
+                    e.OpMem(E::Packed, E::Load, 5, E::R10, static_cast<std::int32_t>(r * stride));
+                    e.Op(E::Packed, E::Mul, 5, 4);
+                    e.Op(E::Packed, E::Add, r, 5);
+                }
+                e.AddImm32(E::R9, 16);
+                e.AddImm32(E::R10, 16);
+                e.Dec(E::R11);
+                e.Jnz(loop);
+                for (std::uint8_t r = 0; r < count; r++) {
+                    e.Op(E::Packed, E::Move, 5, r);
+                    e.Op(E::Packed, E::Unpckh, 5, 5);
+                    e.Op(E::Scalar, E::Add, r, 5);
+                }
+            }
+            if (cols % 2 != 0) {
+                e.OpMem(E::Scalar, E::Load, 4, E::R9, 0);
+                for (std::uint8_t r = 0; r < count; r++) {
+                    e.OpMem(E::Scalar, E::Load, 5, E::R10, static_cast<std::int32_t>(r * stride));
+                    e.Op(E::Scalar, E::Mul, 5, 4);
+                    e.Op(E::Scalar, E::Add, r, 5);
+                }
+            }
+            for (std::uint8_t r = 0; r < count; r++) {
+                e.OpMem(E::Scalar, E::Load, 5, E::RDX, r * sizeof(double));
+                e.Op(E::Scalar, E::Add, r, 5);
+                if (fn == ActivationFunction::ReLU) {
+                    e.Op(E::Scalar, E::Max, r, 6);
+                }
+                else if (fn == ActivationFunction::LeakyReLU) {
+                    e.Op(E::Packed, E::Move, 5, r);
+                    e.OpMem(E::Scalar, E::Mul, 5, E::R8, 0);
+                    e.Op(E::Scalar, E::Max, r, 5);
+                }
+                e.OpMem(E::Scalar, E::Store, r, E::RSI, r * sizeof(double));
+            }
+        };
+        if (rows / 4 > 0) {
+            e.MovImm32(E::RCX, static_cast<std::int32_t>(rows / 4));
+            const std::size_t loop = e.Position();
+            block(4);
+            e.AddImm32(E::RAX, static_cast<std::int32_t>(4 * stride));
+            e.AddImm32(E::RDX, 4 * sizeof(double));
+            e.AddImm32(E::RSI, 4 * sizeof(double));
+            e.Dec(E::RCX);
+            e.Jnz(loop);
+        }
+        if (rows % 4 != 0) {
+            block(rows % 4);
+        }
+        e.Ret();
+
+        // Записываем код в страницы, доступные на запись, затем разрешаем только исполнение
+        const std::size_t size = e.Code().size();
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            return;
+        }
+        std::memcpy(memory, e.Code().data(), size);
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return;
+        }
+        compiled.memory = memory;
+        compiled.size = size;
+        compiled.function = reinterpret_cast<Function>(memory);
+#else
+        (void)layer;
+#endif
+    }
+};
+
+}
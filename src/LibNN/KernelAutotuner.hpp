@@ -0,0 +1,280 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "Kernels.hpp"
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий автоматический подбор ядер умножения матрицы на вектор.
+ * Для каждой формы матрицы весов при первом обращении измеряется время
+ * работы всех вариантов ядер и выбирается самый быстрый.
+ * Результаты сохраняются в файл, ключ - модель процессора, количество доступных
+ * аппаратных потоков и форма матрицы, поэтому последующие запуски на той же машине
+ * подбор не выполняют, а многопоточный выбор не переносится на машину с меньшим числом ядер.
+ */
+class KernelAutotuner
+{
+    // Ключ кэша: модель процессора, количество аппаратных потоков, количество строк, количество столбцов
+    using Key = std::tuple<std::string, std::size_t, std::size_t, std::size_t>;
+public:
+    /**
+     * Конструктор.
+     *
+     * \param cachePath Путь к файлу кэша. Пустая строка - кэш только в памяти
+     */
+    explicit KernelAutotuner(const std::string& cachePath = std::string()):
+        m_cachePath(cachePath),
+        m_cpu(CpuModel()),
+        m_hardwareThreads(std::thread::hardware_concurrency())
+    {
+        Load();
+    }
+    /**
+     * Получение лучшего ядра для матрицы заданной формы.
+     * Если форма встречается впервые, выполняется подбор.
+     *
+     * \param rows Количество строк
+     * \param cols Количество столбцов
+     * \return Ядро
+     */
+    GemvConfig Tune(const std::size_t rows, const std::size_t cols)
+    {
+        const Key key(m_cpu, m_hardwareThreads, rows, cols);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            return it->second;
+        }
+        const auto config = Benchmark(rows, cols);
+        m_cache[key] = config;
+        Save();
+        return config;
+    }
+    /**
+     * Подбор ядер для всех слоёв нейронной сети.
+     *
+     * \param nn Нейронная сеть
+     */
+    void Apply(NeuralNetwork& nn)
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            // Свёрточные слои и слои подвыборки умножение матрицы на вектор не используют
+            if (nn.m_layers[layer].type != LayerType::Dense) {
+                continue;
+            }
+            nn.m_kernels[layer] = Tune(nn.m_weights[layer].Rows(), nn.m_weights[layer].Cols());
+        }
+        // Другое ядро может изменить порядок суммирования и младшие разряды выхода
+        nn.Touch();
+    }
+    /**
+     * Получение количества форм в кэше.
+     *
+     * \return Количество форм
+     */
+    std::size_t CachedCount() const
+    {
+        return m_cache.size();
+    }
+    /**
+     * Получение модели процессора.
+     *
+     * \return Модель процессора либо "unknown"
+     */
+    static std::string CpuModel()
+    {
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.compare(0, 10, "model name") == 0) {
+                const auto colon = line.find(':');
+                if (colon != std::string::npos) {
+                    const auto begin = line.find_first_not_of(' ', colon + 1);
+                    if (begin != std::string::npos) {
+                        return line.substr(begin);
+                    }
+                }
+            }
+        }
+        return "unknown";
+    }
+private:
+    // Путь к файлу кэша
+    std::string m_cachePath;
+    // Модель процессора
+    std::string m_cpu;
+    // Количество аппаратных потоков
+    std::size_t m_hardwareThreads;
+    // Кэш выбранных ядер
+    std::map<Key, GemvConfig> m_cache;
+
+    /**
+     * Измерение всех вариантов ядер для матрицы заданной формы.
+     *
+     * \param rows Количество строк
+     * \param cols Количество столбцов
+     * \return Самое быстрое ядро
+     */
+    static GemvConfig Benchmark(const std::size_t rows, const std::size_t cols)
+    {
+        // Тестовые данные
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<double> ds(-0.5, 0.5);
+        Matrix matrix(rows, cols);
+        Vector vector(cols);
+        for (std::size_t col = 0; col < cols; col++) {
+            vector[col] = ds(rng);
+            for (std::size_t row = 0; row < rows; row++) {
+                matrix[row][col] = ds(rng);
+            }
+        }
+        // Варианты ядер
+        std::vector<GemvConfig> candidates;
+        for (auto kernel : { GemvKernel::Naive, GemvKernel::Unroll4, GemvKernel::Rows4 }) {
+            candidates.push_back({ kernel, 1 });
+        }
+        // Многопоточные варианты имеет смысл измерять только на больших матрицах,
+        // на маленьких пробуждение потоков пула дороже самого умножения
+        const std::size_t hardwareThreads = std::thread::hardware_concurrency();
+        if (rows * cols >= (1u << 16) && hardwareThreads > 1) {
+            for (std::size_t threads = 2; threads <= hardwareThreads; threads *= 2) {
+                for (auto kernel : { GemvKernel::Unroll4, GemvKernel::Rows4 }) {
+                    candidates.push_back({ kernel, threads });
+                }
+            }
+        }
+        GemvConfig best;
+        double bestTime = 0.0;
+        for (const auto& candidate : candidates) {
+            const double time = Measure(candidate, matrix, vector);
+            if (bestTime == 0.0 || time < bestTime) {
+                bestTime = time;
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Измерение времени одного умножения.
+     *
+     * \return Минимальное время умножения в секундах
+     */
+    static double Measure(const GemvConfig& config, const Matrix& matrix, const Vector& vector)
+    {
+        using Clock = std::chrono::steady_clock;
+        // Количество повторов в одном замере подбираем так,
+        // чтобы замер длился не меньше ~0.2 мс
+        std::size_t repeats = 1;
+        double best = 0.0;
+        double sink = 0.0;
+        for (int sample = 0; sample < 5; sample++) {
+            double time = 0.0;
+            do {
+                const auto start = Clock::now();
+                for (std::size_t i = 0; i < repeats; i++) {
+                    sink += Gemv(config, matrix, vector)[0];
+                }
+                time = std::chrono::duration<double>(Clock::now() - start).count();
+                if (time < 2e-4) {
+                    repeats *= 2;
+                }
+            } while (time < 2e-4);
+            time /= repeats;
+            if (sample == 0 || time < best) {
+                best = time;
+            }
+        }
+        // Не даём компилятору выбросить вычисления
+        volatile double keep = sink;
+        (void)keep;
+        return best;
+    }
+
+    void Load()
+    {
+        if (m_cachePath.empty()) {
+            return;
+        }
+        Read(m_cache);
+    }
+
+    /**
+     * Чтение записей файла кэша. Записи, уже имеющиеся в cache, не заменяются.
+     *
+     * \param cache Кэш
+     */
+    void Read(std::map<Key, GemvConfig>& cache) const
+    {
+        std::ifstream file(m_cachePath);
+        std::string line;
+        // Формат строки: модель процессора \t аппаратные потоки \t строки \t столбцы \t ядро \t потоки
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            std::string cpu;
+            std::size_t hardwareThreads = 0, rows = 0, cols = 0, threads = 0;
+            int kernel = 0;
+            if (std::getline(fields, cpu, '\t') && (fields >> hardwareThreads >> rows >> cols >> kernel >> threads)
+                && kernel >= 0 && kernel <= static_cast<int>(GemvKernel::Rows4)
+                && threads > 0 && threads <= std::max<std::size_t>(hardwareThreads, 1)) {
+                cache.insert({ Key(cpu, hardwareThreads, rows, cols), { static_cast<GemvKernel>(kernel), threads } });
+            }
+        }
+    }
+
+    /**
+     * Сохранение кэша. Файл записывается во временный файл и заменяется переименованием,
+     * поэтому при аварийном завершении или одновременных запусках он не обрезается
+     * и не перемешивается. Записи, добавленные в файл другими запусками, сохраняются.
+     */
+    void Save()
+    {
+        if (m_cachePath.empty()) {
+            return;
+        }
+        // Записи для других процессоров и форм сохраняются вместе с текущими
+        Read(m_cache);
+        const std::string temporary = m_cachePath + ".tmp" + std::to_string(detail::ProcessId());
+        {
+            std::ofstream file(temporary, std::ios::trunc);
+            Write(file);
+            if (!file) {
+                std::remove(temporary.c_str());
+                return;
+            }
+        }
+#if defined(_WIN32)
+        // На Windows rename не заменяет существующий файл
+        std::remove(m_cachePath.c_str());
+#endif
+        if (std::rename(temporary.c_str(), m_cachePath.c_str()) != 0) {
+            std::remove(temporary.c_str());
+        }
+    }
+
+    void Write(std::ofstream& file) const
+    {
+        for (const auto& entry : m_cache) {
+            file << std::get<0>(entry.first) << '\t'
+                 << std::get<1>(entry.first) << '\t'
+                 << std::get<2>(entry.first) << '\t'
+                 << std::get<3>(entry.first) << '\t'
+                 << static_cast<int>(entry.second.kernel) << '\t'
+                 << entry.second.threads << '\n';
+        }
+    }
+};
+
+}
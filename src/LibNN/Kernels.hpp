@@ -0,0 +1,271 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#   include <process.h>
+#else
+#   include <unistd.h>
+#endif
+
+#include "Matrix.hpp"
+
+namespace NN
+{
+
+/**
+ * Вариант ядра умножения матрицы на вектор.
+ */
+enum class GemvKernel
+{
+    Naive,      // Скалярное произведение каждой строки
+    Unroll4,    // Развёртка по столбцам на 4 независимых аккумулятора
+    Rows4       // Блок из 4 строк, общий проход по вектору
+};
+
+/**
+ * Структура, описывающая выбранное ядро умножения матрицы на вектор.
+ */
+struct GemvConfig
+{
+    // Вариант ядра
+    GemvKernel kernel = GemvKernel::Naive;
+    // Количество потоков
+    std::size_t threads = 1;
+};
+
+namespace detail{
+
+    /**
+     * Умножение строк матрицы [begin, end) на вектор.
+     *
+     * \param kernel Вариант ядра
+     * \param matrix Матрица
+     * \param vector Вектор
+     * \param result Результат
+     * \param begin Первая строка
+     * \param end Строка, следующая за последней
+     */
+    inline void GemvRows(
+        const GemvKernel kernel,
+        const Matrix& matrix,
+        const Vector& vector,
+        Vector& result,
+        const std::size_t begin,
+        const std::size_t end)
+    {
+        const std::size_t cols = vector.Size();
+        const double* x = vector.Data();
+        switch (kernel) {
+        case GemvKernel::Naive:
+            for (std::size_t row = begin; row < end; row++) {
+                result[row] = matrix[row] ^ vector;
+            }
+            break;
+        case GemvKernel::Unroll4:
+            for (std::size_t row = begin; row < end; row++) {
+                const double* w = matrix[row].Data();
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                std::size_t col = 0;
+                for (; col + 4 <= cols; col += 4) {
+                    s0 += w[col] * x[col];
+                    s1 += w[col + 1] * x[col + 1];
+                    s2 += w[col + 2] * x[col + 2];
+                    s3 += w[col + 3] * x[col + 3];
+                }
+                for (; col < cols; col++) {
+                    s0 += w[col] * x[col];
+                }
+                result[row] = (s0 + s1) + (s2 + s3);
+            }
+            break;
+        case GemvKernel::Rows4:
+            {
+                std::size_t row = begin;
+                for (; row + 4 <= end; row += 4) {
+                    const double* w0 = matrix[row].Data();
+                    const double* w1 = matrix[row + 1].Data();
+                    const double* w2 = matrix[row + 2].Data();
+                    const double* w3 = matrix[row + 3].Data();
+                    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                    for (std::size_t col = 0; col < cols; col++) {
+                        // Элемент вектора загружается один раз для четырёх строк
+                        const double value = x[col];
+                        s0 += w0[col] * value;
+                        s1 += w1[col] * value;
+                        s2 += w2[col] * value;
+                        s3 += w3[col] * value;
+                    }
+                    result[row] = s0;
+                    result[row + 1] = s1;
+                    result[row + 2] = s2;
+                    result[row + 3] = s3;
+                }
+                for (; row < end; row++) {
+                    result[row] = matrix[row] ^ vector;
+                }
+            }
+            break;
+        }
+    }
+
+    /**
+     * Получение идентификатора процесса.
+     *
+     * \return Идентификатор процесса
+     */
+    inline long ProcessId()
+    {
+#if defined(_WIN32)
+        return static_cast<long>(_getpid());
+#else
+        return static_cast<long>(getpid());
+#endif
+    }
+
+    /**
+     * Пул потоков для многопоточного умножения матрицы на вектор, общий для процесса.
+     * Потоки создаются при первом обращении и живут до завершения процесса,
+     * поэтому умножение не платит за создание потоков.
+     * Будятся только потоки, участвующие в задаче.
+     * Пул одновременно обслуживает одно умножение: если он занят другим потоком
+     * (стадией конвейера, потоком проверки и т.п.) или процесс порождён fork
+     * и потоков пула в нём нет, умножение выполняется вызывающим потоком.
+     * Так количество потоков умножения не превышает размера пула.
+     */
+    class GemvPool
+    {
+        // Поток пула и его признак готовой задачи
+        struct Worker
+        {
+            std::thread thread;
+            std::condition_variable wake;
+            bool ready = false;
+        };
+    public:
+        /**
+         * Получение пула процесса. Пул не уничтожается: его потоки
+         * могут ждать задачу во время завершения процесса.
+         *
+         * \return Пул
+         */
+        static GemvPool& Instance()
+        {
+            static GemvPool* pool = new GemvPool();
+            return *pool;
+        }
+        /**
+         * Выполнение частей задачи: части [0, parts - 1) выполняют потоки пула,
+         * последнюю часть - вызывающий поток.
+         *
+         * \param parts Количество частей
+         * \param task Задача, принимающая номер части
+         * \return false - пул занят либо недоступен, задача не выполнялась
+         */
+        bool TryRun(const std::size_t parts, const std::function<void(std::size_t)>& task)
+        {
+            std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+            if (!busy.owns_lock() || ProcessId() != m_process) {
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                while (m_workers.size() + 1 < parts) {
+                    m_workers.emplace_back(new Worker);
+                    m_workers.back()->thread = std::thread(&GemvPool::Loop, this, m_workers.size() - 1);
+                }
+                m_task = &task;
+                m_pending = parts - 1;
+                for (std::size_t i = 0; i + 1 < parts; i++) {
+                    m_workers[i]->ready = true;
+                }
+            }
+            for (std::size_t i = 0; i + 1 < parts; i++) {
+                m_workers[i]->wake.notify_one();
+            }
+            task(parts - 1);
+            // Ожидание со сном: если процессоров меньше, чем потоков,
+            // потоки пула должны получить процессор вызывающего
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [&]() { return m_pending == 0; });
+            return true;
+        }
+    private:
+        // Захватывается на время умножения
+        std::mutex m_busy;
+        std::mutex m_mutex;
+        std::condition_variable m_done;
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        // Текущая задача
+        const std::function<void(std::size_t)>* m_task = nullptr;
+        // Количество невыполненных частей потоков пула
+        std::size_t m_pending = 0;
+        // Процесс, в котором созданы потоки пула
+        long m_process = ProcessId();
+
+        GemvPool() = default;
+        GemvPool(const GemvPool&) = delete;
+        GemvPool& operator = (const GemvPool&) = delete;
+
+        void Loop(const std::size_t index)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            Worker& worker = *m_workers[index];
+            for (;;) {
+                worker.wake.wait(lock, [&]() { return worker.ready; });
+                worker.ready = false;
+                const auto task = m_task;
+                lock.unlock();
+                (*task)(index);
+                lock.lock();
+                if (--m_pending == 0) {
+                    m_done.notify_one();
+                }
+            }
+        }
+    };
+
+}
+
+/**
+ * Умножение матрицы на вектор выбранным ядром.
+ *
+ * \param config Ядро
+ * \param matrix Матрица
+ * \param vector Вектор
+ * \return Вектор
+ */
+inline Vector Gemv(const GemvConfig& config, const Matrix& matrix, const Vector& vector) noexcept(false)
+{
+    // Количество столбцов матрицы должно быть равно размеру вектора
+    if (matrix.Cols() != vector.Size()) {
+        throw std::out_of_range("Number of columns of matrix must be equal to the size of vector");
+    }
+    Vector result(matrix.Rows());
+    const std::size_t threads = std::min(config.threads, matrix.Rows());
+    if (threads <= 1) {
+        detail::GemvRows(config.kernel, matrix, vector, result, 0, matrix.Rows());
+        return result;
+    }
+    // Делим строки между потоками поровну. Текущий поток считает последнюю часть
+    const std::size_t chunk = (matrix.Rows() + threads - 1) / threads;
+    const bool parallel = detail::GemvPool::Instance().TryRun(threads, [&](const std::size_t part) {
+        const std::size_t begin = std::min(part * chunk, matrix.Rows());
+        const std::size_t end = std::min(begin + chunk, matrix.Rows());
+        detail::GemvRows(config.kernel, matrix, vector, result, begin, end);
+    });
+    if (!parallel) {
+        // Пул занят другим умножением - считаем все строки сами
+        detail::GemvRows(config.kernel, matrix, vector, result, 0, matrix.Rows());
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,353 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#   include <pthread.h>
+#   include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#   include <immintrin.h>
+#   define NN_CPU_RELAX() _mm_pause()
+#else
+#   define NN_CPU_RELAX() ((void)0)
+#endif
+
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+namespace detail{
+
+    /**
+     * Получение списка процессоров, на которых процессу разрешено выполняться.
+     * Процессор вызывающего потока ставится первым.
+     *
+     * \return Номера процессоров
+     */
+    inline std::vector<int> AllowedCpus()
+    {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &set)) {
+                    cpus.push_back(cpu);
+                }
+            }
+        }
+        const auto current = std::find(cpus.begin(), cpus.end(), sched_getcpu());
+        if (current != cpus.end()) {
+            std::rotate(cpus.begin(), current, current + 1);
+        }
+#endif
+        if (cpus.empty()) {
+            const unsigned count = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned cpu = 0; cpu < count; cpu++) {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+        return cpus;
+    }
+
+}
+
+/**
+ * Класс, реализующий прямой проход одного запроса с минимальной задержкой.
+ * Строки умножения матрицы весов на вектор независимы, поэтому строки
+ * полносвязного слоя делятся между потоками: вызывающим и потоками пула.
+ * Потоки пула закреплены за процессорами и ждут запроса вращением,
+ * слои разделяются барьером с обращением фазы, тоже на вращении,
+ * поэтому на пути запроса нет системных вызовов пробуждения потоков.
+ * Слои, в которых меньше cutoff умножений, а также свёрточные слои и слои подвыборки
+ * выполняются одним вызывающим потоком: на них синхронизация дороже вычислений.
+ * Если процессор один, пул не создаётся и проход совпадает с NeuralNetwork::Forward.
+ * Результат совпадает с NeuralNetwork::Forward побитово.
+ * Потоки пула занимают свои процессоры всё время жизни объекта.
+ * Одновременные вызовы Forward не допускаются, изменять сеть во время вызова нельзя.
+ */
+class LatencyExecutor
+{
+    // Счётчик с отдельной строкой кэша
+    struct alignas(64) Counter
+    {
+        std::atomic<std::uint32_t> value{ 0 };
+    };
+public:
+    /**
+     * Конструктор. Запускает пул потоков.
+     *
+     * \param nn Нейронная сеть
+     * \param threads Количество потоков вместе с вызывающим, 0 - по количеству процессоров.
+     *                Ограничивается количеством доступных процессоров
+     * \param cutoff Наименьшее количество умножений в слое, при котором слой делится между потоками
+     */
+    explicit LatencyExecutor(const NeuralNetwork& nn, const std::size_t threads = 0, const std::size_t cutoff = 16384) noexcept(false):
+        m_nn(nn),
+        m_cpus(detail::AllowedCpus()),
+        m_threads(threads == 0 ? m_cpus.size() : std::min(threads, m_cpus.size())),
+        m_cutoff(cutoff),
+        m_inputs(nn.LayersCount()),
+        m_sums(nn.LayersCount()),
+        m_outputs(nn.LayersCount()),
+        m_parallel(nn.LayersCount(), false),
+        m_request(nullptr),
+        m_stop(false)
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            if (nn.m_layers[layer].type == LayerType::Dense) {
+                // Вход слоя с нейроном смещения: предыдущий слой пишет выход прямо сюда
+                m_inputs[layer] = Vector(nn.m_weights[layer].Cols());
+                m_inputs[layer][m_inputs[layer].Size() - 1] = nn.m_layers[layer].bias;
+                m_sums[layer] = Vector(nn.m_weights[layer].Rows());
+            }
+            m_outputs[layer] = Vector(nn.LayerShape(layer + 1).Size());
+        }
+        SetCutoff(cutoff);
+        for (std::size_t worker = 1; worker < m_threads; worker++) {
+            m_workers.emplace_back(&LatencyExecutor::Worker, this, worker);
+        }
+    }
+    LatencyExecutor(const LatencyExecutor&) = delete;
+    LatencyExecutor& operator = (const LatencyExecutor&) = delete;
+    ~LatencyExecutor()
+    {
+        m_stop.store(true, std::memory_order_relaxed);
+        m_generation.value.fetch_add(1, std::memory_order_release);
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+    /**
+     * Установка порога разделения слоёв между потоками.
+     *
+     * \param cutoff Наименьшее количество умножений в слое, при котором слой делится между потоками
+     */
+    void SetCutoff(const std::size_t cutoff)
+    {
+        m_cutoff = cutoff;
+        for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+            const Matrix& weights = m_nn.m_weights[layer];
+            // Каждому потоку достаётся хотя бы один блок из 4 строк
+            m_parallel[layer] = m_threads > 1
+                && m_nn.m_layers[layer].type == LayerType::Dense
+                && weights.Rows() * weights.Cols() >= m_cutoff
+                && weights.Rows() >= 4 * m_threads;
+        }
+    }
+    /**
+     * Получение количества потоков.
+     *
+     * \return Количество потоков вместе с вызывающим
+     */
+    std::size_t Threads() const
+    {
+        return m_threads;
+    }
+    /**
+     * Проверка, делится ли слой между потоками.
+     *
+     * \param layer Номер слоя
+     * \return true - строки слоя вычисляются всеми потоками
+     */
+    bool Parallel(const std::size_t layer) const noexcept(false)
+    {
+        if (layer >= m_parallel.size()) {
+            throw std::out_of_range("Layer index out of range");
+        }
+        return m_parallel[layer];
+    }
+    /**
+     * Прямой проход по нейронной сети
+     *
+     * \param input Вектор входных данных
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const Vector& input) noexcept(false)
+    {
+        if (input.Size() != m_nn.LayerShape(0).Size()) {
+            throw std::out_of_range("Input size does not match the network");
+        }
+        if (std::find(m_parallel.begin(), m_parallel.end(), true) == m_parallel.end()) {
+            return m_nn.Forward(input);
+        }
+        if (m_parallel[0]) {
+            std::copy(input.Data(), input.Data() + input.Size(), m_inputs[0].Data());
+        }
+        m_request = &input;
+        m_generation.value.fetch_add(1, std::memory_order_release);
+        Run(0, m_sense);
+        // Исключение передаётся вызывающему только после того, как все потоки прошли все барьеры
+        if (m_error) {
+            const std::exception_ptr error = m_error;
+            m_error = nullptr;
+            std::rethrow_exception(error);
+        }
+        return m_outputs.back();
+    }
+private:
+    // Нейронная сеть
+    const NeuralNetwork& m_nn;
+    // Доступные процессоры
+    std::vector<int> m_cpus;
+    // Количество потоков вместе с вызывающим
+    std::size_t m_threads;
+    // Порог разделения слоя между потоками
+    std::size_t m_cutoff;
+    // Входы полносвязных слоёв с нейроном смещения
+    std::vector<Vector> m_inputs;
+    // Взвешенные суммы полносвязных слоёв
+    std::vector<Vector> m_sums;
+    // Выходы слоёв
+    std::vector<Vector> m_outputs;
+    // Признаки слоёв, делящихся между потоками
+    std::vector<bool> m_parallel;
+    // Входной вектор текущего запроса
+    const Vector* m_request;
+    // Номер запроса, его увеличение запускает потоки пула
+    Counter m_generation;
+    // Счётчик пришедших к барьеру и фаза барьера
+    Counter m_arrived;
+    Counter m_phase;
+    // Локальная фаза барьера вызывающего потока
+    std::uint32_t m_sense = 0;
+    // Исключение вызывающего потока в текущем запросе
+    std::exception_ptr m_error;
+    std::atomic<bool> m_stop;
+    std::vector<std::thread> m_workers;
+
+    /**
+     * Поток пула: ожидание запроса и участие в его вычислении.
+     *
+     * \param worker Номер потока
+     */
+    void Worker(const std::size_t worker)
+    {
+        Pin(worker);
+        std::uint32_t seen = 0;
+        std::uint32_t sense = 0;
+        for (;;) {
+            std::uint32_t generation;
+            std::size_t spins = 0;
+            while ((generation = m_generation.value.load(std::memory_order_acquire)) == seen) {
+                NN_CPU_RELAX();
+                // Долгий простой: уступаем процессор, не засыпая
+                if (++spins >= (1 << 16)) {
+                    std::this_thread::yield();
+                    spins = 0;
+                }
+            }
+            seen = generation;
+            if (m_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            Run(worker, sense);
+        }
+    }
+
+    /**
+     * Вычисление запроса одним из потоков.
+     * Полносвязные слои, делящиеся между потоками, вычисляются по блокам строк,
+     * остальные слои вычисляет вызывающий поток.
+     * Барьер ставится после слоя, если он или следующий слой делятся между потоками.
+     * Если вызывающий поток получил исключение, он запоминает его, пропускает
+     * вычисление оставшихся слоёв, но проходит все барьеры, иначе потоки пула ждали бы его вечно.
+     *
+     * \param worker Номер потока, 0 - вызывающий
+     * \param sense Локальная фаза барьера потока
+     */
+    void Run(const std::size_t worker, std::uint32_t& sense)
+    {
+        const std::size_t layers = m_nn.LayersCount();
+        for (std::size_t layer = 0; layer < layers; layer++) {
+            const bool next = layer + 1 < layers && m_parallel[layer + 1];
+            // Выход слоя пишется во вход следующего слоя, если тот делится между потоками
+            double* output = next ? m_inputs[layer + 1].Data() : m_outputs[layer].Data();
+            if (m_parallel[layer]) {
+                const Matrix& weights = m_nn.m_weights[layer];
+                const std::size_t blocks = (weights.Rows() + 3) / 4;
+                const std::size_t begin = std::min(weights.Rows(), blocks * worker / m_threads * 4);
+                const std::size_t end = std::min(weights.Rows(), blocks * (worker + 1) / m_threads * 4);
+                detail::GemvRows(m_nn.m_kernels[layer].kernel, weights, m_inputs[layer], m_sums[layer], begin, end);
+                const ActivationFunction fn = m_nn.m_layers[layer].fn;
+                if (fn != ActivationFunction::Softmax) {
+                    NN::Activate(fn, m_nn.m_accuracy, m_sums[layer].Data() + begin, output + begin, end - begin);
+                }
+                else {
+                    // Нормировка требует всех сумм слоя
+                    Barrier(sense);
+                    if (worker == 0) {
+                        NN::Activate(fn, m_nn.m_accuracy, m_sums[layer].Data(), output, m_sums[layer].Size());
+                    }
+                }
+            }
+            else if (worker == 0 && !m_error) {
+                try {
+                    const Vector result = m_nn.Forward(layer == 0 ? *m_request : m_outputs[layer - 1], layer);
+                    std::copy(result.Data(), result.Data() + result.Size(), output);
+                }
+                catch (...) {
+                    m_error = std::current_exception();
+                }
+            }
+            if (m_parallel[layer] || next) {
+                Barrier(sense);
+            }
+        }
+        // Выход последнего слоя всегда пишется в m_outputs
+    }
+
+    /**
+     * Барьер с обращением фазы на вращении: последний пришедший поток сбрасывает счётчик
+     * и меняет фазу, остальные ждут смены фазы.
+     *
+     * \param sense Локальная фаза потока
+     */
+    void Barrier(std::uint32_t& sense)
+    {
+        sense ^= 1;
+        if (m_arrived.value.fetch_add(1, std::memory_order_acq_rel) + 1 == m_threads) {
+            m_arrived.value.store(0, std::memory_order_relaxed);
+            m_phase.value.store(sense, std::memory_order_release);
+        }
+        else {
+            while (m_phase.value.load(std::memory_order_acquire) != sense) {
+                NN_CPU_RELAX();
+            }
+        }
+    }
+
+    /**
+     * Закрепление потока пула за процессором.
+     * Вызывающий поток не закрепляется, потоки пула занимают процессоры,
+     * кроме того, на котором он выполнялся при создании пула.
+     *
+     * \param worker Номер потока
+     */
+    void Pin(const std::size_t worker)
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[worker % m_cpus.size()], &set);
+        // Закрепление - только оптимизация, ошибка не мешает вычислению
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)worker;
+#endif
+    }
+};
+
+}
+
+#undef NN_CPU_RELAX
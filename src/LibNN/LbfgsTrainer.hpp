@@ -0,0 +1,619 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+#include "LossFunctions.hpp"
+
+namespace NN
+{
+
+/**
+ * Структура, описывающая результат обучения методом L-BFGS.
+ */
+struct LbfgsReport
+{
+    // Количество итераций
+    std::size_t iterations;
+    // Количество вычислений функции потерь и градиента
+    std::size_t evaluations;
+    // Функция потерь на всей обучающей выборке
+    double loss;
+    // Евклидова норма градиента
+    double gradientNorm;
+    // Достигнут критерий остановки (а не ограничение количества итераций)
+    bool converged;
+};
+
+/**
+ * Класс, реализующий обучение нейронной сети на всей обучающей выборке сразу
+ * квазиньютоновским методом L-BFGS.
+ * Все веса сети рассматриваются как один вектор параметров (см. GetParameters).
+ * Функция потерь - среднее по примерам: для среднеквадратичной ошибки
+ * половина суммы квадратов ошибок выходов, для перекрёстной энтропии -
+ * её сумма по выходам. Точный градиент по всей выборке вычисляется
+ * несколькими потоками по блокам примеров фиксированного размера:
+ * поток t вычисляет блоки t, t + T, ... в отдельные для каждого блока суммы,
+ * которые затем складываются в порядке блоков, поэтому результат
+ * побитово не зависит от количества потоков.
+ * Направление спуска строится двухцикловой рекурсией по последним парам
+ * изменений параметров и градиентов, длина шага выбирается линейным поиском,
+ * удовлетворяющим сильным условиям Вольфе.
+ * Подходит для небольших сетей и выборок, которые целиком помещаются в кэш.
+ */
+class LbfgsTrainer
+{
+    // Рабочие данные потока
+    struct Worker
+    {
+        // Взвешенные суммы, выходы и градиенты слоёв
+        std::vector<Vector> sums;
+        std::vector<Vector> outputs;
+        std::vector<Vector> gradients;
+        // Развёрнутые входы свёрточных слоёв
+        std::vector<Matrix> columns;
+    };
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть для обучения
+     * \param loss Функция потерь
+     * \param threads Количество потоков, 0 - по количеству процессоров
+     */
+    LbfgsTrainer(
+        NeuralNetwork& nn,
+        const LossFunction loss = LossFunction::MeanSquaredError,
+        const std::size_t threads = 0) noexcept(false):
+        m_nn(nn),
+        m_loss(loss),
+        m_threads(threads != 0 ? threads : std::max<std::size_t>(1, std::thread::hardware_concurrency())),
+        m_history(10),
+        m_gradientTolerance(1e-8),
+        m_lossTolerance(0.0),
+        m_maxStep(std::numeric_limits<double>::infinity()),
+        m_offsets(nn.LayersCount() + 1, 0)
+    {
+        if (m_loss == LossFunction::CrossEntropy && !SupportsCrossEntropy(nn.m_layers.back().fn)) {
+            throw std::invalid_argument("Cross-entropy requires softmax or sigmoid output layer");
+        }
+        // Смещения весов слоёв в векторе параметров
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            m_offsets[layer + 1] = m_offsets[layer] + nn.m_weights[layer].Rows() * nn.m_weights[layer].Cols();
+        }
+    }
+    /**
+     * Установка количества запоминаемых пар изменений.
+     *
+     * \param history Количество пар
+     */
+    void SetHistory(const std::size_t history) noexcept(false)
+    {
+        if (history == 0) {
+            throw std::invalid_argument("History size must be non-zero");
+        }
+        m_history = history;
+    }
+    /**
+     * Установка критериев остановки.
+     *
+     * \param gradientNorm Обучение останавливается, когда норма градиента становится меньше
+     * \param loss Обучение останавливается, когда функция потерь становится меньше
+     */
+    void SetTolerance(const double gradientNorm, const double loss)
+    {
+        m_gradientTolerance = gradientNorm;
+        m_lossTolerance = loss;
+    }
+    /**
+     * Установка ограничения длины шага.
+     * Длинные шаги на плато функции потерь могут перебросить параметры
+     * в область плохого локального минимума.
+     *
+     * \param maxStep Максимальная евклидова длина изменения параметров за итерацию, по умолчанию не ограничена
+     */
+    void SetMaxStep(const double maxStep) noexcept(false)
+    {
+        if (!(maxStep > 0.0)) {
+            throw std::invalid_argument("Maximum step must be positive");
+        }
+        m_maxStep = maxStep;
+    }
+    /**
+     * Обучение нейронной сети на всей выборке.
+     *
+     * \param inputs Массив векторов входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \param maxIterations Максимальное количество итераций
+     * \return Результат обучения
+     */
+    LbfgsReport Train(const std::vector<Vector>& inputs, const std::vector<Vector>& outputs, const std::size_t maxIterations = 100) noexcept(false)
+    {
+        if (inputs.empty() || inputs.size() != outputs.size()) {
+            throw std::invalid_argument("Training set must be non-empty and have equal number of inputs and outputs");
+        }
+        // Ошибки размеров проверяем здесь, в рабочих потоках их некому обработать
+        for (std::size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].Size() != m_nn.LayerShape(0).Size() || outputs[i].Size() != m_nn.LayerShape(m_nn.LayersCount()).Size()) {
+                throw std::out_of_range("Size of input or output does not match the network");
+            }
+        }
+        m_inputs = &inputs;
+        m_outputs = &outputs;
+        m_evaluations = 0;
+
+        const std::size_t n = m_nn.ParametersCount();
+        std::vector<double> x(n), g(n), d(n), xNew(n), gNew(n);
+        m_nn.GetParameters(x.data());
+        double f = Evaluate(x, g);
+        // Пары изменений параметров s и градиентов y, от старых к новым
+        std::deque<std::vector<double>> s, y;
+        std::deque<double> rho;
+        LbfgsReport report{ 0, 0, f, Norm(g), false };
+        while (report.iterations < maxIterations) {
+            if (report.gradientNorm < m_gradientTolerance || f < m_lossTolerance) {
+                report.converged = true;
+                break;
+            }
+            Direction(g, s, y, rho, d);
+            double dg = Dot(d, g);
+            if (dg >= 0.0) {
+                // Не направление спуска - сбрасываем накопленную кривизну
+                s.clear();
+                y.clear();
+                rho.clear();
+                Direction(g, s, y, rho, d);
+                dg = Dot(d, g);
+            }
+            // Без накопленной кривизны масштаб направления неизвестен,
+            // поэтому первый шаг ограничиваем единичной длиной
+            const double maxAlpha = m_maxStep / Norm(d);
+            const double alpha = std::min(maxAlpha, s.empty() ? std::min(1.0, 1.0 / report.gradientNorm) : 1.0);
+            double fNew;
+            if (!LineSearch(x, f, d, dg, alpha, maxAlpha, xNew, fNew, gNew)) {
+                if (s.empty()) {
+                    // Даже по антиградиенту функцию уменьшить не удалось
+                    break;
+                }
+                s.clear();
+                y.clear();
+                rho.clear();
+                continue;
+            }
+            std::vector<double> sk(n), yk(n);
+            for (std::size_t i = 0; i < n; i++) {
+                sk[i] = xNew[i] - x[i];
+                yk[i] = gNew[i] - g[i];
+            }
+            const double sy = Dot(sk, yk);
+            // Пара сохраняется, только если кривизна положительна, иначе приближение обратного гессиана
+            // перестанет быть положительно определённым
+            if (sy > 1e-12 * Norm(sk) * Norm(yk)) {
+                if (s.size() == m_history) {
+                    s.pop_front();
+                    y.pop_front();
+                    rho.pop_front();
+                }
+                s.push_back(std::move(sk));
+                y.push_back(std::move(yk));
+                rho.push_back(1.0 / sy);
+            }
+            x.swap(xNew);
+            g.swap(gNew);
+            f = fNew;
+            report.iterations++;
+            report.gradientNorm = Norm(g);
+        }
+        // Оставляем в сети лучшие найденные параметры
+        m_nn.SetParameters(x.data());
+        report.loss = f;
+        report.evaluations = m_evaluations;
+        return report;
+    }
+    /**
+     * Вычисление функции потерь и её градиента по весам на всей выборке.
+     *
+     * \param inputs Массив векторов входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \param gradient Массив размером ParametersCount() для градиента
+     * \return Функция потерь
+     */
+    double Gradient(const std::vector<Vector>& inputs, const std::vector<Vector>& outputs, double* gradient) noexcept(false)
+    {
+        if (inputs.empty() || inputs.size() != outputs.size()) {
+            throw std::invalid_argument("Training set must be non-empty and have equal number of inputs and outputs");
+        }
+        m_inputs = &inputs;
+        m_outputs = &outputs;
+        std::vector<double> x(m_nn.ParametersCount()), g(x.size());
+        m_nn.GetParameters(x.data());
+        const double loss = Evaluate(x, g);
+        std::copy(g.begin(), g.end(), gradient);
+        return loss;
+    }
+private:
+    // Ссылка на нейронную сеть
+    NeuralNetwork& m_nn;
+    // Функция потерь
+    LossFunction m_loss;
+    // Количество потоков
+    std::size_t m_threads;
+    // Количество запоминаемых пар изменений
+    std::size_t m_history;
+    // Критерии остановки
+    double m_gradientTolerance;
+    double m_lossTolerance;
+    // Максимальная длина шага
+    double m_maxStep;
+    // Смещения весов слоёв в векторе параметров
+    std::vector<std::size_t> m_offsets;
+    // Количество примеров в блоке, суммы по которому складываются в порядке блоков
+    static constexpr std::size_t BlockSize = 16;
+    // Рабочие данные потоков
+    std::vector<Worker> m_workers;
+    // Функции потерь и градиенты блоков примеров
+    std::vector<double> m_blockLosses;
+    std::vector<double> m_blockGradients;
+    // Обучающие данные
+    const std::vector<Vector>* m_inputs = nullptr;
+    const std::vector<Vector>* m_outputs = nullptr;
+    // Количество вычислений функции потерь
+    std::size_t m_evaluations = 0;
+
+    static double Dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double result = 0.0;
+        for (std::size_t i = 0; i < a.size(); i++) {
+            result += a[i] * b[i];
+        }
+        return result;
+    }
+
+    static double Norm(const std::vector<double>& a)
+    {
+        return std::sqrt(Dot(a, a));
+    }
+
+    /**
+     * Направление спуска: произведение приближения обратного гессиана на антиградиент
+     * (двухцикловая рекурсия).
+     */
+    static void Direction(
+        const std::vector<double>& g,
+        const std::deque<std::vector<double>>& s,
+        const std::deque<std::vector<double>>& y,
+        const std::deque<double>& rho,
+        std::vector<double>& d)
+    {
+        for (std::size_t i = 0; i < g.size(); i++) {
+            d[i] = -g[i];
+        }
+        std::vector<double> alpha(s.size());
+        for (std::size_t k = s.size(); k-- > 0;) {
+            alpha[k] = rho[k] * Dot(s[k], d);
+            for (std::size_t i = 0; i < d.size(); i++) {
+                d[i] -= alpha[k] * y[k][i];
+            }
+        }
+        // Начальное приближение гессиана - единичная матрица с масштабом по последней паре
+        if (!s.empty()) {
+            const double gamma = 1.0 / (rho.back() * Dot(y.back(), y.back()));
+            for (auto& value : d) {
+                value *= gamma;
+            }
+        }
+        for (std::size_t k = 0; k < s.size(); k++) {
+            const double beta = rho[k] * Dot(y[k], d);
+            for (std::size_t i = 0; i < d.size(); i++) {
+                d[i] += (alpha[k] - beta) * s[k][i];
+            }
+        }
+    }
+
+    /**
+     * Линейный поиск по направлению d, удовлетворяющий сильным условиям Вольфе:
+     * достаточное уменьшение функции и уменьшение модуля производной по направлению.
+     *
+     * \param x Текущие параметры
+     * \param f Функция потерь в x
+     * \param d Направление
+     * \param dg Производная по направлению в x (отрицательна)
+     * \param alpha Начальная длина шага
+     * \param maxAlpha Максимальная длина шага
+     * \param xNew Новые параметры
+     * \param fNew Функция потерь в xNew
+     * \param gNew Градиент в xNew
+     * \return false, если функцию уменьшить не удалось
+     */
+    bool LineSearch(
+        const std::vector<double>& x,
+        const double f,
+        const std::vector<double>& d,
+        const double dg,
+        double alpha,
+        const double maxAlpha,
+        std::vector<double>& xNew,
+        double& fNew,
+        std::vector<double>& gNew)
+    {
+        const double c1 = 1e-4;
+        const double c2 = 0.9;
+        const std::size_t maxSteps = 20;
+        // Значение и производная в точке шага
+        auto phi = [&](const double step, double& derivative) {
+            for (std::size_t i = 0; i < x.size(); i++) {
+                xNew[i] = x[i] + step * d[i];
+            }
+            const double value = Evaluate(xNew, gNew);
+            derivative = Dot(gNew, d);
+            return value;
+        };
+        // Границы интервала, содержащего подходящий шаг (zoom): lo - лучший шаг с достаточным уменьшением
+        auto zoom = [&](double lo, double hi, double fLo, double dLo, double fHi) {
+            for (std::size_t step = 0; step < maxSteps; step++) {
+                // Минимум квадратичной интерполяции по f(lo), f'(lo), f(hi),
+                // ограниченный серединой интервала с запасом от краёв
+                const double width = hi - lo;
+                const double denominator = 2.0 * (fHi - fLo - dLo * width);
+                double trial = denominator > 0.0 ? lo - dLo * width * width / denominator : lo + 0.5 * width;
+                const double low = lo + 0.1 * width;
+                const double high = lo + 0.9 * width;
+                if (!(trial >= std::min(low, high) && trial <= std::max(low, high))) {
+                    trial = lo + 0.5 * width;
+                }
+                double derivative;
+                const double value = phi(trial, derivative);
+                if (value > f + c1 * trial * dg || value >= fLo) {
+                    hi = trial;
+                    fHi = value;
+                }
+                else {
+                    if (std::fabs(derivative) <= -c2 * dg) {
+                        fNew = value;
+                        return true;
+                    }
+                    if (derivative * (hi - lo) >= 0.0) {
+                        hi = lo;
+                        fHi = fLo;
+                    }
+                    lo = trial;
+                    fLo = value;
+                    dLo = derivative;
+                }
+            }
+            // Условие на производную не выполнено - берём лучший шаг с достаточным уменьшением
+            if (lo == 0.0) {
+                return false;
+            }
+            double derivative;
+            fNew = phi(lo, derivative);
+            return true;
+        };
+        double previous = 0.0;
+        double fPrevious = f;
+        double dPrevious = dg;
+        for (std::size_t step = 0; step < maxSteps; step++) {
+            double derivative;
+            const double value = phi(alpha, derivative);
+            if (!std::isfinite(value) || value > f + c1 * alpha * dg || (step > 0 && value >= fPrevious)) {
+                if (!std::isfinite(value)) {
+                    // Переполнение - уменьшаем шаг, пока функция не станет конечной
+                    alpha = previous + 0.5 * (alpha - previous);
+                    continue;
+                }
+                return zoom(previous, alpha, fPrevious, dPrevious, value);
+            }
+            if (std::fabs(derivative) <= -c2 * dg) {
+                fNew = value;
+                return true;
+            }
+            if (derivative >= 0.0) {
+                return zoom(alpha, previous, value, derivative, fPrevious);
+            }
+            if (alpha >= maxAlpha) {
+                // Функция уменьшилась достаточно, а длиннее шаг быть не может
+                fNew = value;
+                return true;
+            }
+            previous = alpha;
+            fPrevious = value;
+            dPrevious = derivative;
+            alpha = std::min(2.0 * alpha, maxAlpha);
+        }
+        if (previous == 0.0) {
+            return false;
+        }
+        // Шаг продолжает расти - принимаем последний, функция уменьшилась
+        fNew = phi(previous, dPrevious);
+        return true;
+    }
+
+    /**
+     * Вычисление функции потерь и градиента при параметрах x.
+     * Параметры записываются в сеть, потоки читают её одновременно.
+     * Суммы всех блоков хранятся до сложения: (примеры / BlockSize) * ParametersCount() чисел.
+     *
+     * \param x Параметры
+     * \param gradient Градиент
+     * \return Функция потерь
+     */
+    double Evaluate(const std::vector<double>& x, std::vector<double>& gradient)
+    {
+        m_evaluations++;
+        m_nn.SetParameters(x.data());
+        const std::size_t samples = m_inputs->size();
+        const std::size_t blocks = (samples + BlockSize - 1) / BlockSize;
+        const std::size_t threads = std::min(m_threads, blocks);
+        const std::size_t n = gradient.size();
+        m_workers.resize(threads);
+        m_blockLosses.assign(blocks, 0.0);
+        m_blockGradients.assign(blocks * n, 0.0);
+        // Потоки запускаются один раз за вычисление, поток t вычисляет блоки t, t + threads, ...
+        const auto work = [this, blocks, threads](const std::size_t t) {
+            for (std::size_t block = t; block < blocks; block += threads) {
+                Accumulate(m_workers[t], block);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (std::size_t t = 1; t < threads; t++) {
+            pool.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& thread : pool) {
+            thread.join();
+        }
+        // Суммы блоков складываются в порядке блоков
+        double loss = 0.0;
+        std::fill(gradient.begin(), gradient.end(), 0.0);
+        for (std::size_t block = 0; block < blocks; block++) {
+            loss += m_blockLosses[block];
+            const double* g = m_blockGradients.data() + block * n;
+            for (std::size_t i = 0; i < n; i++) {
+                gradient[i] += g[i];
+            }
+        }
+        const double scale = 1.0 / samples;
+        for (auto& value : gradient) {
+            value *= scale;
+        }
+        return loss * scale;
+    }
+
+    /**
+     * Накопление функции потерь и градиента по блоку примеров.
+     *
+     * \param worker Рабочие данные потока
+     * \param block Номер блока
+     */
+    void Accumulate(Worker& worker, const std::size_t block)
+    {
+        const std::size_t layers = m_nn.LayersCount();
+        const std::size_t begin = block * BlockSize;
+        const std::size_t end = std::min(begin + BlockSize, m_inputs->size());
+        double* parameters = m_blockGradients.data() + block * m_offsets.back();
+        worker.sums.resize(layers);
+        worker.outputs.resize(layers);
+        worker.gradients.resize(layers);
+        worker.columns.resize(layers);
+        for (std::size_t sample = begin; sample < end; sample++) {
+            const Vector& input = (*m_inputs)[sample];
+            // Прямой проход с сохранением сумм и выходов слоёв
+            for (std::size_t layer = 0; layer < layers; layer++) {
+                const Vector& layerInput = layer == 0 ? input : worker.outputs[layer - 1];
+                if (m_nn.m_layers[layer].type == LayerType::Convolution) {
+                    worker.columns[layer] = Im2Col(layerInput, m_nn.m_shapes[layer], m_nn.m_layers[layer].window, m_nn.m_layers[layer].bias);
+                    worker.sums[layer] = m_nn.ConvolutionSums(worker.columns[layer], layer);
+                }
+                else {
+                    worker.sums[layer] = m_nn.Sums(layerInput, layer);
+                }
+                worker.outputs[layer] = m_nn.Activate(worker.sums[layer], layer);
+            }
+            m_blockLosses[block] += OutputGradients(worker, (*m_outputs)[sample]);
+            // Обратный проход: градиент по весам слоя и ошибка входа слоя по исходным весам
+            for (std::size_t layer = layers; layer-- > 0;) {
+                const Vector& layerInput = layer == 0 ? input : worker.outputs[layer - 1];
+                const auto& config = m_nn.m_layers[layer];
+                const Matrix& weights = m_nn.m_weights[layer];
+                const Vector& gradient = worker.gradients[layer];
+                double* target = parameters + m_offsets[layer];
+                switch (config.type) {
+                case LayerType::Dense:
+                    for (std::size_t row = 0; row < weights.Rows(); row++) {
+                        double* g = target + row * weights.Cols();
+                        for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                            g[col] += gradient[row] * layerInput[col];
+                        }
+                        g[weights.Cols() - 1] += gradient[row] * config.bias;
+                    }
+                    if (layer > 0) {
+                        Vector error(weights.Cols() - 1);
+                        error = 0.0;
+                        for (std::size_t row = 0; row < weights.Rows(); row++) {
+                            const double* w = weights[row].Data();
+                            for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                                error[col] += w[col] * gradient[row];
+                            }
+                        }
+                        worker.gradients[layer - 1] = std::move(error);
+                    }
+                    break;
+                case LayerType::Convolution:
+                    {
+                        const Matrix matrix = GradientMatrix(gradient, weights.Rows());
+                        const Matrix weightsGradient = MultiplyByTransposed(matrix, worker.columns[layer]);
+                        for (std::size_t row = 0; row < weights.Rows(); row++) {
+                            for (std::size_t col = 0; col < weights.Cols(); col++) {
+                                target[row * weights.Cols() + col] += weightsGradient[row][col];
+                            }
+                        }
+                        if (layer > 0) {
+                            worker.gradients[layer - 1] = Col2Im(TransposedMultiply(weights, matrix), m_nn.m_shapes[layer], config.window);
+                        }
+                    }
+                    break;
+                case LayerType::MaxPooling:
+                    if (layer > 0) {
+                        worker.gradients[layer - 1] = MaxPoolBackward(layerInput, gradient, m_nn.m_shapes[layer], config.window);
+                    }
+                    break;
+                }
+                if (layer > 0 && m_nn.m_layers[layer - 1].type != LayerType::MaxPooling) {
+                    NN::MultiplyByDerivative(m_nn.m_layers[layer - 1].fn, worker.sums[layer - 1].Data(),
+                        worker.outputs[layer - 1].Data(), worker.gradients[layer - 1].Data(), worker.gradients[layer - 1].Size());
+                }
+            }
+        }
+    }
+
+    /**
+     * Вычисление функции потерь примера и градиентов выходного слоя.
+     *
+     * \param worker Рабочие данные потока
+     * \param target Желаемые выходные данные
+     * \return Функция потерь примера
+     */
+    double OutputGradients(Worker& worker, const Vector& target) const
+    {
+        const std::size_t last = m_nn.LayersCount() - 1;
+        const std::size_t size = target.Size();
+        worker.gradients[last] = Vector(size);
+        if (m_loss == LossFunction::CrossEntropy) {
+            return CrossEntropyWithGradient(m_nn.m_layers[last].fn, worker.sums[last].Data(), target.Data(),
+                worker.outputs[last].Data(), worker.gradients[last].Data(), size);
+        }
+        double loss = 0.0;
+        for (std::size_t i = 0; i < size; i++) {
+            const double error = worker.outputs[last][i] - target[i];
+            worker.gradients[last][i] = error;
+            loss += 0.5 * error * error;
+        }
+        if (m_nn.m_layers[last].type != LayerType::MaxPooling) {
+            NN::MultiplyByDerivative(m_nn.m_layers[last].fn, worker.sums[last].Data(),
+                worker.outputs[last].Data(), worker.gradients[last].Data(), size);
+        }
+        return loss;
+    }
+
+    /**
+     * Представление градиентов свёрточного слоя в виде матрицы (фильтр x положение окна)
+     */
+    static Matrix GradientMatrix(const Vector& gradient, const std::size_t filters)
+    {
+        const std::size_t positions = gradient.Size() / filters;
+        Matrix result(filters, positions);
+        for (std::size_t filter = 0; filter < filters; filter++) {
+            std::copy(gradient.Data() + filter * positions, gradient.Data() + (filter + 1) * positions, result[filter].Data());
+        }
+        return result;
+    }
+};
+
+}
@@ -0,0 +1,92 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "ActivationFunctions.hpp"
+
+namespace NN
+{
+
+/**
+ * Тип функции потерь.
+ */
+enum class LossFunction
+{
+    MeanSquaredError,   // Среднеквадратичная ошибка
+    CrossEntropy        // Перекрёстная энтропия
+};
+
+/**
+ * Проверка, поддерживается ли перекрёстная энтропия для функции активации выходного слоя.
+ * Для сигмоиды и softmax градиент по взвешенным суммам равен p - y.
+ *
+ * \param fn Функция активации выходного слоя
+ * \return true, если поддерживается
+ */
+inline bool SupportsCrossEntropy(const ActivationFunction fn)
+{
+    return fn == ActivationFunction::Softmax || fn == ActivationFunction::Sigmoid;
+}
+
+/**
+ * Совмещённое вычисление выхода слоя, перекрёстной энтропии и градиента.
+ * Выход вычисляется прямо из взвешенных сумм (логитов) через log-sum-exp,
+ * поэтому вычисление устойчиво к переполнению, а градиент p - y
+ * получается без отдельного прохода по производной функции активации.
+ *
+ * \param fn Функция активации выходного слоя: Softmax либо Sigmoid
+ * \param logits Взвешенные суммы выходного слоя
+ * \param target Желаемые выходные данные
+ * \param output Выход слоя (вероятности)
+ * \param gradient Градиент по взвешенным суммам
+ * \param size Количество выходов
+ * \return Перекрёстная энтропия: для softmax и для сигмоиды (бинарная) - сумма по выходам,
+ * так что градиент p - y - её точный градиент. Для вывода её можно усреднить по выходам
+ */
+inline double CrossEntropyWithGradient(
+    const ActivationFunction fn,
+    const double* logits,
+    const double* target,
+    double* output,
+    double* gradient,
+    const std::size_t size) noexcept(false)
+{
+    double loss = 0.0;
+    switch (fn) {
+    case ActivationFunction::Softmax:
+        {
+            // log(sum(e^z)) = max + log(sum(e^(z - max)))
+            const double max = *std::max_element(logits, logits + size);
+            double sum = 0.0;
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] = std::exp(logits[i] - max);
+                sum += output[i];
+            }
+            const double logSumExp = max + std::log(sum);
+            const double inverseSum = 1.0 / sum;
+            for (std::size_t i = 0; i < size; i++) {
+                output[i] *= inverseSum;
+                gradient[i] = output[i] - target[i];
+                // -y * log(p) = -y * (z - logSumExp)
+                loss -= target[i] * (logits[i] - logSumExp);
+            }
+        }
+        break;
+    case ActivationFunction::Sigmoid:
+        for (std::size_t i = 0; i < size; i++) {
+            output[i] = detail::Sigmoid(logits[i]);
+            gradient[i] = output[i] - target[i];
+            // log(p) = -softplus(-z), log(1 - p) = -softplus(z)
+            loss += target[i] * detail::Softplus(-logits[i])
+                + (1.0 - target[i]) * detail::Softplus(logits[i]);
+        }
+        break;
+    default:
+        throw std::invalid_argument("Cross-entropy requires softmax or sigmoid output layer");
+    }
+    return loss;
+}
+
+}
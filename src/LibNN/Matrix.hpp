@@ -68,7 +68,7 @@ public:
      */
     std::size_t Cols() const
     {
-        return m_matrix[0].Size();
+        return m_matrix.empty() ? 0 : m_matrix[0].Size();
     }
     /**
      * Умножение матрицы на вектор ("вектор-столбец").
@@ -102,6 +102,88 @@ public:
         // Возвращаем результат
         return result;
     }
+    /**
+     * Умножение матриц.
+     * Пример:
+     * [[a11, a12]]   [[b11, b12]]   [[a11*b11 + a12*b21, a11*b12 + a12*b22]]
+     * [[a21, a22]] * [[b21, b22]] = [[a21*b11 + a22*b21, a21*b12 + a22*b22]]
+     *
+     * A(MxK) * B(KxN) = C(MxN)
+     *
+     * \param a Первая матрица
+     * \param b Вторая матрица
+     * \return Матрица
+     */
+    friend Matrix operator * (const Matrix& a, const Matrix& b) noexcept(false)
+    {
+        // Количество столбцов первой матрицы должно быть равно количеству строк второй
+        if (a.Cols() != b.Rows()) {
+            throw std::out_of_range("Number of columns of first matrix must be equal to the number of rows of second matrix");
+        }
+        Matrix result(a.Rows(), b.Cols());
+        const std::size_t cols = b.Cols();
+        for (std::size_t i = 0; i < a.Rows(); i++) {
+            double* c = result[i].Data();
+            // Строка результата - это сумма строк второй матрицы
+            // с коэффициентами из строки первой матрицы.
+            // Внутренний цикл идёт по строкам подряд и векторизуется
+            for (std::size_t k = 0; k < a.Cols(); k++) {
+                const double value = a[i][k];
+                const double* row = b[k].Data();
+                for (std::size_t j = 0; j < cols; j++) {
+                    c[j] += value * row[j];
+                }
+            }
+        }
+        return result;
+    }
+    /**
+     * Умножение матрицы на транспонированную матрицу без транспонирования: A * B^T.
+     * Элемент результата - скалярное произведение строк матриц.
+     *
+     * \param a Первая матрица (MxK)
+     * \param b Вторая матрица (NxK)
+     * \return Матрица (MxN)
+     */
+    friend Matrix MultiplyByTransposed(const Matrix& a, const Matrix& b) noexcept(false)
+    {
+        if (a.Cols() != b.Cols()) {
+            throw std::out_of_range("Matrices must have the same number of columns");
+        }
+        Matrix result(a.Rows(), b.Rows());
+        for (std::size_t i = 0; i < a.Rows(); i++) {
+            for (std::size_t j = 0; j < b.Rows(); j++) {
+                result[i][j] = a[i] ^ b[j];
+            }
+        }
+        return result;
+    }
+    /**
+     * Умножение транспонированной матрицы на матрицу без транспонирования: A^T * B.
+     *
+     * \param a Первая матрица (KxM)
+     * \param b Вторая матрица (KxN)
+     * \return Матрица (MxN)
+     */
+    friend Matrix TransposedMultiply(const Matrix& a, const Matrix& b) noexcept(false)
+    {
+        if (a.Rows() != b.Rows()) {
+            throw std::out_of_range("Matrices must have the same number of rows");
+        }
+        Matrix result(a.Cols(), b.Cols());
+        const std::size_t cols = b.Cols();
+        for (std::size_t k = 0; k < a.Rows(); k++) {
+            const double* row = b[k].Data();
+            for (std::size_t i = 0; i < a.Cols(); i++) {
+                const double value = a[k][i];
+                double* c = result[i].Data();
+                for (std::size_t j = 0; j < cols; j++) {
+                    c[j] += value * row[j];
+                }
+            }
+        }
+        return result;
+    }
     /**
      * Вычитание вектора из матрицы.
      * Пример:
@@ -0,0 +1,263 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+/**
+ * Неизменяемая версия весов нейронной сети.
+ */
+struct ModelSnapshot
+{
+    // Номер версии
+    std::size_t version;
+    // Копия нейронной сети
+    NeuralNetwork network;
+};
+
+/**
+ * Класс, реализующий публикацию версий нейронной сети
+ * для конкурентных читателей.
+ * Текущая версия хранится в атомарном указателе. Читатели получают её
+ * без блокировок (wait-free), писатель публикует новые версии,
+ * а старые версии освобождаются, когда их больше не держит ни один читатель
+ * (освобождение памяти на основе эпох).
+ */
+class ModelPublisher
+{
+    // Слот читателя. Содержит эпоху, в которой читатель получил версию,
+    // либо признак того, что читатель не держит версию
+    struct alignas(64) ReaderSlot
+    {
+        std::atomic<std::uint64_t> epoch{ IdleEpoch };
+        std::atomic<bool> used{ false };
+    };
+    // Версия, ожидающая освобождения
+    struct RetiredSnapshot
+    {
+        const ModelSnapshot* snapshot;
+        std::uint64_t epoch;
+    };
+public:
+    // Признак того, что читатель не держит версию
+    static constexpr std::uint64_t IdleEpoch = std::numeric_limits<std::uint64_t>::max();
+
+    /**
+     * Класс, предоставляющий доступ к версии на время своей жизни.
+     */
+    class ReadGuard
+    {
+    public:
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator = (const ReadGuard&) = delete;
+        ~ReadGuard()
+        {
+            // Сообщаем, что версия больше не используется
+            m_slot->epoch.store(IdleEpoch, std::memory_order_release);
+        }
+        const ModelSnapshot& operator * () const
+        {
+            return *m_snapshot;
+        }
+        const ModelSnapshot* operator -> () const
+        {
+            return m_snapshot;
+        }
+    private:
+        ReadGuard(ReaderSlot* slot, const ModelSnapshot* snapshot):
+            m_slot(slot),
+            m_snapshot(snapshot) {}
+
+        ReaderSlot* m_slot;
+        const ModelSnapshot* m_snapshot;
+
+        friend class ModelPublisher;
+    };
+
+    /**
+     * Класс читателя. Каждый поток-читатель регистрирует собственного читателя.
+     * Одновременно читатель может держать только одну версию.
+     */
+    class Reader
+    {
+    public:
+        Reader(const Reader&) = delete;
+        Reader& operator = (const Reader&) = delete;
+        Reader(Reader&& other) noexcept:
+            m_publisher(other.m_publisher),
+            m_slot(other.m_slot)
+        {
+            other.m_slot = nullptr;
+        }
+        ~Reader()
+        {
+            if (m_slot) {
+                // Освобождаем слот для других читателей
+                m_slot->epoch.store(IdleEpoch, std::memory_order_release);
+                m_slot->used.store(false, std::memory_order_release);
+            }
+        }
+        /**
+         * Получение текущей версии нейронной сети.
+         * Выполняется за конечное число шагов без блокировок.
+         *
+         * \return Объект, удерживающий версию
+         */
+        ReadGuard Acquire() const
+        {
+            // Объявляем эпоху, в которой начинаем чтение
+            m_slot->epoch.store(m_publisher->m_epoch.load());
+            // После объявления эпохи версия не будет освобождена
+            return ReadGuard(m_slot, m_publisher->m_current.load());
+        }
+    private:
+        Reader(const ModelPublisher* publisher, ReaderSlot* slot):
+            m_publisher(publisher),
+            m_slot(slot) {}
+
+        const ModelPublisher* m_publisher;
+        ReaderSlot* m_slot;
+
+        friend class ModelPublisher;
+    };
+
+    /**
+     * Конструктор.
+     *
+     * \param nn Начальная версия нейронной сети
+     * \param maxReaders Максимальное количество читателей
+     */
+    ModelPublisher(const NeuralNetwork& nn, const std::size_t maxReaders = 64):
+        m_slots(new ReaderSlot[maxReaders]),
+        m_slotsCount(maxReaders),
+        m_epoch(1),
+        m_current(new ModelSnapshot{ 1, nn }),
+        m_version(1) {}
+    ModelPublisher(const ModelPublisher&) = delete;
+    ModelPublisher& operator = (const ModelPublisher&) = delete;
+    /**
+     * Деструктор. К моменту уничтожения читателей быть не должно.
+     */
+    ~ModelPublisher()
+    {
+        for (auto& retired : m_retired) {
+            delete retired.snapshot;
+        }
+        delete m_current.load();
+    }
+    /**
+     * Регистрация читателя.
+     *
+     * \return Читатель
+     */
+    Reader RegisterReader() noexcept(false)
+    {
+        for (std::size_t i = 0; i < m_slotsCount; i++) {
+            bool expected = false;
+            if (m_slots[i].used.compare_exchange_strong(expected, true)) {
+                return Reader(this, &m_slots[i]);
+            }
+        }
+        throw std::runtime_error("Too many readers");
+    }
+    /**
+     * Публикация новой версии нейронной сети.
+     * Копирует веса, поэтому исходную сеть можно продолжать обучать.
+     *
+     * \param nn Нейронная сеть
+     * \return Номер опубликованной версии
+     */
+    std::size_t Publish(const NeuralNetwork& nn)
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        // Готовим новую версию до публикации
+        auto snapshot = new ModelSnapshot{ ++m_version, nn };
+        // Публикуем новую версию
+        auto old = m_current.exchange(snapshot);
+        // Старую версию могут держать только читатели,
+        // объявившие эпоху не позже текущей
+        m_retired.push_back({ old, m_epoch.fetch_add(1) });
+        ReclaimLocked();
+        return snapshot->version;
+    }
+    /**
+     * Освобождение версий, которые больше не держит ни один читатель.
+     */
+    void Reclaim()
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        ReclaimLocked();
+    }
+    /**
+     * Получение номера текущей версии.
+     * Номер читается под мьютексом писателей: без эпохи читателя
+     * текущая версия может быть освобождена параллельной публикацией.
+     *
+     * \return Номер версии
+     */
+    std::size_t Version() const
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        return m_version;
+    }
+    /**
+     * Получение количества версий, ожидающих освобождения.
+     *
+     * \return Количество версий
+     */
+    std::size_t RetiredCount() const
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        return m_retired.size();
+    }
+private:
+    // Слоты читателей
+    std::unique_ptr<ReaderSlot[]> m_slots;
+    // Количество слотов читателей
+    std::size_t m_slotsCount;
+    // Глобальная эпоха
+    std::atomic<std::uint64_t> m_epoch;
+    // Текущая версия
+    std::atomic<const ModelSnapshot*> m_current;
+    // Номер последней версии
+    std::size_t m_version;
+    // Версии, ожидающие освобождения
+    std::vector<RetiredSnapshot> m_retired;
+    // Мьютекс писателей. Читатели его не используют
+    mutable std::mutex m_writerMutex;
+
+    void ReclaimLocked()
+    {
+        // Минимальная эпоха среди активных читателей
+        std::uint64_t minEpoch = IdleEpoch;
+        for (std::size_t i = 0; i < m_slotsCount; i++) {
+            const auto epoch = m_slots[i].epoch.load();
+            if (epoch < minEpoch) {
+                minEpoch = epoch;
+            }
+        }
+        // Освобождаем версии, снятые с публикации раньше,
+        // чем начал чтение любой из активных читателей
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < m_retired.size(); i++) {
+            if (m_retired[i].epoch < minEpoch) {
+                delete m_retired[i].snapshot;
+            }
+            else {
+                m_retired[kept++] = m_retired[i];
+            }
+        }
+        m_retired.resize(kept);
+    }
+};
+
+}
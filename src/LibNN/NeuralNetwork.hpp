@@ -1,32 +1,100 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
 #include "Matrix.hpp"
+#include "Kernels.hpp"
+#include "Convolution.hpp"
 #include "ActivationFunctions.hpp"
 
 namespace NN
 {
 
 class NeuralNetworkTrainer;
+class PopulationTrainer;
+class KernelAutotuner;
+class Pruner;
+class SparseNeuralNetwork;
+class Validator;
+class CodeGenerator;
+class JitNeuralNetwork;
+class Profiler;
+class PipelineTrainer;
+class LbfgsTrainer;
+class LatencyExecutor;
+class DataParallelTrainer;
+
+/**
+ * Тип слоя нейронной сети.
+ */
+enum class LayerType
+{
+    Dense,          // Полносвязный слой
+    Convolution,    // Свёрточный слой
+    MaxPooling      // Слой подвыборки по максимуму
+};
 
 /**
  * Структура, описывающая слой нейронной сети
  */
 struct LayerConfig
 {
-    // Количество нейронов
+    // Количество нейронов (для свёрточного слоя - количество фильтров)
     std::size_t neurons;
     // Тип функции активации
     ActivationFunction fn;
     // Значение нейрона смещения
     double bias;
+    // Тип слоя
+    LayerType type = LayerType::Dense;
+    // Окно свёртки или подвыборки
+    Window window = { 0, 1, 0 };
+
+    /**
+     * Конфигурация свёрточного слоя.
+     *
+     * \param filters Количество фильтров (каналов выхода)
+     * \param size Размер квадратного ядра свёртки
+     * \param fn Тип функции активации
+     * \param bias Значение нейрона смещения
+     * \param stride Шаг свёртки
+     * \param padding Дополнение нулями по краям
+     * \return Конфигурация слоя
+     */
+    static LayerConfig Convolution(
+        const std::size_t filters,
+        const std::size_t size,
+        const ActivationFunction fn,
+        const double bias = 1.0,
+        const std::size_t stride = 1,
+        const std::size_t padding = 0)
+    {
+        return { filters, fn, bias, LayerType::Convolution, { size, stride, padding } };
+    }
+    /**
+     * Конфигурация слоя подвыборки по максимуму.
+     * Количество каналов совпадает с количеством каналов входа.
+     *
+     * \param size Размер квадратного окна
+     * \param stride Шаг окна, 0 - равен размеру окна
+     * \return Конфигурация слоя
+     */
+    static LayerConfig MaxPooling(const std::size_t size, const std::size_t stride = 0)
+    {
+        return { 0, ActivationFunction::ReLU, 0.0, LayerType::MaxPooling, { size, stride == 0 ? size : stride, 0 } };
+    }
 };
 
 /**
  * Класс, реализующий нейронную сеть.
+ * Полносвязные, свёрточные слои и слои подвыборки можно чередовать в любом порядке.
+ * Выход слоя - вектор, который следующий слой трактует в соответствии со своей формой входа.
  */
 // TODO: Добавить нейрон смещения к слоям
 // TODO: Добавить возможность сохранения\загрузки весов из файла
-// TODO: Реализовать другие типы нейронных сетей: свёрточные, рекурентные и др
+// TODO: Реализовать другие типы нейронных сетей: рекурентные и др
 class NeuralNetwork
 {
 public:
@@ -37,19 +105,46 @@ public:
      * \param layers Массив с конфигурацией слоёв
      */
     NeuralNetwork(const std::size_t inputs, const std::vector<LayerConfig>& layers):
+        NeuralNetwork(Shape{ 1, 1, inputs }, layers) {}
+    /**
+     * Конструктор.
+     *
+     * \param input Форма входа нейронной сети
+     * \param layers Массив с конфигурацией слоёв
+     */
+    NeuralNetwork(const Shape& input, const std::vector<LayerConfig>& layers) noexcept(false):
         m_weights(layers.size()),   // Количество матриц весов соответстует количеству слоёв
-        m_layers(layers)            // Сохраняем конфигурацию
+        m_layers(layers),           // Сохраняем конфигурацию
+        m_shapes(layers.size() + 1),
+        m_kernels(layers.size()),   // По умолчанию все слои используют простое ядро
+        m_accuracy(ActivationAccuracy::Exact),
+        m_version(NextVersion())
     {
-        // Веса первого слоя - это матрица, имеющая количество строк,
-        // равное количеству нейронов первого слоя,
-        // и количество столбцов, равное количеству входов
-        m_weights[0] = Matrix(layers[0].neurons, inputs + 1);
-        // Проходим по остальным слоям
-        for (std::size_t i = 1; i < layers.size(); i++) {
-            // Веса текущего слоя - это матрица, имеющая количество строк,
-            // равное количеству нейронов текущего слоя,
-            // и количество столбцов, равное количеству нейронов предыдущего слоя
-            m_weights[i] = Matrix(layers[i].neurons, layers[i - 1].neurons + 1);
+        // Форма входа первого слоя - форма входа сети
+        m_shapes[0] = input;
+        // Проходим по слоям
+        for (std::size_t i = 0; i < layers.size(); i++) {
+            const Shape& shape = m_shapes[i];
+            switch (layers[i].type) {
+            case LayerType::Dense:
+                // Веса полносвязного слоя - это матрица, имеющая количество строк,
+                // равное количеству нейронов слоя,
+                // и количество столбцов, равное количеству входов слоя и нейрону смещения
+                m_weights[i] = Matrix(layers[i].neurons, shape.Size() + 1);
+                m_shapes[i + 1] = { layers[i].neurons, 1, 1 };
+                break;
+            case LayerType::Convolution:
+                // Веса свёрточного слоя - это матрица, строка которой - ядро одного фильтра
+                // по всем каналам входа, и нейрон смещения
+                m_weights[i] = Matrix(layers[i].neurons,
+                    shape.channels * layers[i].window.size * layers[i].window.size + 1);
+                m_shapes[i + 1] = layers[i].window.Output(shape, layers[i].neurons);
+                break;
+            case LayerType::MaxPooling:
+                // У слоя подвыборки весов нет
+                m_shapes[i + 1] = layers[i].window.Output(shape, shape.channels);
+                break;
+            }
         }
     }
     /**
@@ -61,6 +156,80 @@ public:
     {
         return m_weights.size();
     }
+    /**
+     * Получение номера версии весов.
+     * Номер меняется при любом изменении весов или параметров, влияющих на выход сети,
+     * и уникален среди всех сетей процесса: копии сети имеют одинаковый номер,
+     * пока одна из них не изменится. Все, кто изменяет веса, обязаны вызывать Touch.
+     *
+     * \return Номер версии
+     */
+    std::uint64_t Version() const
+    {
+        return m_version;
+    }
+    /**
+     * Получение формы входа слоя.
+     *
+     * \param layer Номер слоя; номер, равный количеству слоёв, - форма выхода сети
+     * \return Форма
+     */
+    const Shape& LayerShape(const std::size_t layer) const
+    {
+        return m_shapes[layer];
+    }
+    /**
+     * Получение общего количества весов нейронной сети.
+     *
+     * \return Количество весов
+     */
+    std::size_t ParametersCount() const
+    {
+        std::size_t count = 0;
+        for (const auto& weights : m_weights) {
+            count += weights.Rows() * weights.Cols();
+        }
+        return count;
+    }
+    /**
+     * Копирование всех весов нейронной сети в плоский массив:
+     * слой за слоем, строка за строкой.
+     *
+     * \param parameters Массив размером ParametersCount()
+     */
+    void GetParameters(double* parameters) const
+    {
+        for (const auto& weights : m_weights) {
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                parameters = std::copy(weights[row].Data(), weights[row].Data() + weights.Cols(), parameters);
+            }
+        }
+    }
+    /**
+     * Установка всех весов нейронной сети из плоского массива (см. GetParameters).
+     *
+     * \param parameters Массив размером ParametersCount()
+     */
+    void SetParameters(const double* parameters)
+    {
+        for (auto& weights : m_weights) {
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                std::copy(parameters, parameters + weights.Cols(), weights[row].Data());
+                parameters += weights.Cols();
+            }
+        }
+        Touch();
+    }
+    /**
+     * Установка точности вычисления функций активации.
+     *
+     * \param accuracy Точность
+     */
+    void SetActivationAccuracy(const ActivationAccuracy accuracy)
+    {
+        m_accuracy = accuracy;
+        Touch();
+    }
     /**
      * Прямой проход по нейронной сети
      *
@@ -73,12 +242,12 @@ public:
         // Проходим по первому слою, подав на него входной вектор
         // В output получим выход первого слоя,
         // и это будет входом следующего слоя
-        auto output = Forward(VectorWithBias(input, m_layers[0].bias), 0);
+        auto output = Forward(input, 0);
         // Проходим по остальным слоям
         for (std::size_t i = 1; i < m_weights.size(); i++) {
             // Сейчас в output хранится выходной вектор предыдущего слоя
             // Подадим output на вход текущего слоя
-            output = Forward(VectorWithBias(output, m_layers[i].bias), i);
+            output = Forward(output, i);
             // Теперь в output выход текущего слоя
         }
         // Прошли по всем слоям, значит в output выход последнего слоя.
@@ -90,20 +259,104 @@ private:
     std::vector<Matrix> m_weights;
     // Массив с конфигурациями слоёв
     std::vector<LayerConfig> m_layers;
+    // Массив с формами входов слоёв и формой выхода сети
+    std::vector<Shape> m_shapes;
+    // Массив с ядрами умножения матрицы весов на вектор для каждого слоя
+    std::vector<GemvConfig> m_kernels;
+    // Точность вычисления функций активации
+    ActivationAccuracy m_accuracy;
+    // Номер версии весов
+    std::uint64_t m_version;
+
+    /**
+     * Получение нового номера версии, общего для всех сетей процесса.
+     *
+     * \return Номер версии
+     */
+    static std::uint64_t NextVersion()
+    {
+        static std::atomic<std::uint64_t> counter{ 0 };
+        return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    /**
+     * Отметка изменения весов: присвоение сети нового номера версии.
+     */
+    void Touch()
+    {
+        m_version = NextVersion();
+    }
 
     /**
      * Прямой проход по слою нейронной сети
-     * 
+     *
      * \param input Вектор входных данных
      * \param layer Номер слоя
      * \return Вектор выходных данных
      */
     Vector Forward(const Vector& input, const std::size_t layer) const
     {
-        // Умножаем матрицу весов на вектор входных данных
+        // Вычисляем взвешенные суммы слоя
         // К получившемуся вектору применим функцию активации
         // Вернём получившийся вектор
-        return (m_weights[layer] * input).ApplyFunction(GetFunction(m_layers[layer].fn));
+        return Activate(Sums(input, layer), layer);
+    }
+
+    /**
+     * Вычисление взвешенных сумм слоя (выхода слоя до функции активации)
+     *
+     * \param input Вектор входных данных
+     * \param layer Номер слоя
+     * \return Вектор взвешенных сумм
+     */
+    Vector Sums(const Vector& input, const std::size_t layer) const
+    {
+        switch (m_layers[layer].type) {
+        case LayerType::Convolution:
+            return ConvolutionSums(Im2Col(input, m_shapes[layer], m_layers[layer].window, m_layers[layer].bias), layer);
+        case LayerType::MaxPooling:
+            return MaxPool(input, m_shapes[layer], m_layers[layer].window);
+        default:
+            // Умножаем матрицу весов на вектор входных данных с нейроном смещения
+            return Gemv(m_kernels[layer], m_weights[layer], VectorWithBias(input, m_layers[layer].bias));
+        }
+    }
+
+    /**
+     * Вычисление взвешенных сумм свёрточного слоя по развёрнутому входу
+     *
+     * \param columns Развёрнутый вход слоя (см. Im2Col)
+     * \param layer Номер слоя
+     * \return Вектор взвешенных сумм: канал за каналом
+     */
+    Vector ConvolutionSums(const Matrix& columns, const std::size_t layer) const
+    {
+        // Свёртка - это произведение матрицы фильтров на развёрнутый вход.
+        // Строка результата - канал выхода
+        const Matrix product = m_weights[layer] * columns;
+        Vector result(m_shapes[layer + 1].Size());
+        const std::size_t positions = product.Cols();
+        for (std::size_t filter = 0; filter < product.Rows(); filter++) {
+            std::copy(product[filter].Data(), product[filter].Data() + positions, result.Data() + filter * positions);
+        }
+        return result;
+    }
+
+    /**
+     * Применение функции активации слоя к взвешенным суммам
+     *
+     * \param sums Вектор взвешенных сумм
+     * \param layer Номер слоя
+     * \return Вектор выходных данных
+     */
+    Vector Activate(const Vector& sums, const std::size_t layer) const
+    {
+        // У слоя подвыборки функции активации нет
+        if (m_layers[layer].type == LayerType::MaxPooling) {
+            return sums;
+        }
+        Vector result(sums.Size());
+        NN::Activate(m_layers[layer].fn, m_accuracy, sums.Data(), result.Data(), sums.Size());
+        return result;
     }
 
     static Vector VectorWithBias(const Vector& vector, const double bias)
@@ -117,6 +370,18 @@ private:
     }
 
     friend class NeuralNetworkTrainer;
+    friend class PopulationTrainer;
+    friend class KernelAutotuner;
+    friend class Pruner;
+    friend class SparseNeuralNetwork;
+    friend class Validator;
+    friend class CodeGenerator;
+    friend class JitNeuralNetwork;
+    friend class Profiler;
+    friend class PipelineTrainer;
+    friend class LbfgsTrainer;
+    friend class LatencyExecutor;
+    friend class DataParallelTrainer;
 };
 
 }
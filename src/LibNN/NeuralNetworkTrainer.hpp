@@ -1,12 +1,43 @@
 ﻿#pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
 #include "NeuralNetwork.hpp"
+#include "LossFunctions.hpp"
+#include "Telemetry.hpp"
+#include "Profiler.hpp"
 
 namespace NN
 {
 
+/**
+ * Структура, описывающая память состояний слоёв на последнем шаге обучения:
+ * выходов, взвешенных сумм, развёрнутых входов свёрточных слоёв и градиентов.
+ * Временные векторы и матрицы внутри отдельных операций не учитываются.
+ */
+struct TrainerMemoryReport
+{
+    // Наибольший объём состояний слоёв за шаг, байт
+    std::size_t peak;
+    // Количество сохраняемых границ слоёв, не считая входа сети
+    std::size_t checkpoints;
+    // Количество слоёв, прямой проход по которым выполнен повторно
+    std::size_t recomputed;
+    // Включён режим контрольных точек (при нуле checkpoints повторных вычислений нет,
+    // но состояния слоёв освобождаются по ходу обратного прохода)
+    bool checkpointing;
+};
+
 /**
  * Класс, реализующий "обучатель" нейронной сети.
+ * По умолчанию состояния всех слоёв хранятся между прямым и обратным проходом.
+ * В режиме контрольных точек хранятся только выходы слоёв на выбранных границах,
+ * а состояния слоёв между ними вычисляются повторно при обратном проходе.
+ * Слои до границы корректируются позже слоёв после неё, поэтому повторный проход
+ * даёт те же значения, и результат обучения совпадает с обычным режимом.
  */
 // TODO: Реализовать разные оптимизаторы: Momentum, NAG, Adam и др.
 // TODO: Реализовать обучение с помощью эволюционных алгоритмов
@@ -18,25 +49,56 @@ public:
      *
      * \param nn Нейронная сеть для обучения
      * \param learningRate Скорость обучения
+     * \param momentum Момент
+     * \param loss Функция потерь
      */
     NeuralNetworkTrainer(
         NeuralNetwork& nn,
         const double learningRate,
-        const double momentum):
+        const double momentum,
+        const LossFunction loss = LossFunction::MeanSquaredError) noexcept(false):
         m_nn(nn),                       // Сохраняем ссылку на нейронную сеть
         m_learningRate(learningRate),   // Сохраняем скорость обучения
         m_momentum(momentum),           //
-        m_vx(nn.LayersCount())          //
+        m_loss(loss),                   // Сохраняем функцию потерь
+        m_vx(nn.LayersCount()),         //
+        m_telemetry(nullptr),
+        m_profiler(nullptr),
+        m_profilerThreads(1),
+        m_steps(0),
+        m_squaredGradientNorm(0.0),
+        m_tail(0),
+        m_memory{ 0, 0, 0, false }
     {
+        // Перекрёстная энтропия считается совместно с функцией активации выходного слоя
+        if (m_loss == LossFunction::CrossEntropy && !SupportsCrossEntropy(nn.m_layers.back().fn)) {
+            throw std::invalid_argument("Cross-entropy requires softmax or sigmoid output layer");
+        }
         // Количество элементов в массиве выходных значений
         // должно соответствовать количеству слоёв
         m_outputs.resize(m_nn.LayersCount());
+        // Взвешенные суммы нужны для производных функций активации
+        m_sums.resize(m_nn.LayersCount());
+        // Развёрнутые входы свёрточных слоёв нужны для корректировки их весов
+        m_columns.resize(m_nn.LayersCount());
         // Количество элементов в массиве градиентов
         // должно соответствовать количеству слоёв
         m_gradients.resize(m_nn.LayersCount());
+        m_vw.resize(m_nn.LayersCount());
         for(std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
-            m_vx[layer] = Vector(nn.m_layers[layer].neurons);
-            m_vx[layer] = 0.0;
+            switch (nn.m_layers[layer].type) {
+            case LayerType::Dense:
+                m_vx[layer] = Vector(nn.m_layers[layer].neurons);
+                m_vx[layer] = 0.0;
+                break;
+            case LayerType::Convolution:
+                // Веса фильтров общие для всех положений окна,
+                // поэтому момент накапливается для каждого веса
+                m_vw[layer] = Matrix(nn.m_weights[layer].Rows(), nn.m_weights[layer].Cols());
+                break;
+            case LayerType::MaxPooling:
+                break;
+            }
         }
     }
     /**
@@ -44,105 +106,238 @@ public:
      *
      * \param input Вектор входных данных
      * \param output Вектор желаемых выходных данных
-     * \return Ошибка
+     * \return Ошибка: среднеквадратичная ошибка либо перекрёстная энтропия
      */
     // TODO: Добавить возможность подавать сразу массивы входных и выходных данных
     double Train(const Vector& input, const Vector& output)
     {
+        using Clock = std::chrono::steady_clock;
+        const auto start = m_telemetry != nullptr ? Clock::now() : Clock::time_point();
+        m_steps++;
+        m_squaredGradientNorm = 0.0;
+        m_memory = { 0, m_checkpoints.empty() ? 0 : CountCheckpoints(m_checkpoints), 0, !m_checkpoints.empty() };
+        const bool checkpointing = !m_checkpoints.empty();
         // Делаем прямой проход по сети,
         // попутно запоминая выходные значения каждого слоя
-        // TODO: Реализовать прямой проход одним циклом
-        // Проходим по первому слою, подавая на вход вектор входных данных
-        m_outputs[0] = m_nn.Forward(
-            NeuralNetwork::VectorWithBias(input, m_nn.m_layers[0].bias), 0);
-        // Проходим по остальным слоям
-        for (std::size_t i = 1; i < m_nn.LayersCount(); i++) {
-            m_outputs[i] = m_nn.Forward(
-                NeuralNetwork::VectorWithBias(
-                    m_outputs[i - 1], m_nn.m_layers[i - 1].bias), i);
-        }
-
-        // Для удобства запомним индекс последнего слоя
-        const std::size_t lastLayerIndex = m_nn.LayersCount() - 1;
-        // TODO: Реализовать обратный проход одним циклом
-        // Посчитаем ошибку на выходе сети.
-        // Ошибка на выходе - это разность между выходом сети и желаемым выходом
-        const Vector outputError = m_outputs[lastLayerIndex] - output;
-        // Посчитаем градиенты на последнем слое.
-        // Вектор градиентов последнего слоя - это произведение
-        // вектора ошибок последнего слоя и вектора производных
-        // от выходного вектора последнего слоя
-        m_gradients[lastLayerIndex] = outputError
-            * (m_outputs[lastLayerIndex].ApplyFunction(GetFunctionDerivative(m_nn.m_layers[lastLayerIndex].fn)));
-        m_vx[lastLayerIndex] = m_momentum * m_vx[lastLayerIndex] + m_gradients[lastLayerIndex];
-        // Корректируем веса на последнем слое
-        // Строка матрицы весов - это веса отдельного нейрона
-        // Проходим по весам каждого нейрона последнего слоя
-        for (std::size_t i = 0; i < m_nn.m_weights[lastLayerIndex].Rows(); i++) {
-            // Вектор величин корректировки - это произведение вектора выходов предыдущего слоя,
-            // градиента текущего нейрона и скорости обучения.
-            // Уменьшаем вектор весов текущего нейрона на вектор с величинами корректировки
-            m_nn.m_weights[lastLayerIndex][i] -= NeuralNetwork::VectorWithBias(
-                    m_outputs[lastLayerIndex - 1], m_nn.m_layers[lastLayerIndex - 1].bias)
-                * m_vx[lastLayerIndex][i] * m_learningRate;
-        }
-
-        // Проходим по другим слоям, от большего к меньшему, те двигаемся обратно,
-        // от выходного слоя к входному (до первого слоя)
-        for (std::size_t currentLayerIndex = lastLayerIndex - 1; currentLayerIndex >= 1; currentLayerIndex--) {
-            // Посчитаем вектор ошибок текущего слоя - это произведение
-            // транспонированной матрицы весов следующего слоя
-            // и вектора градиентов следующего слоя
-            auto currentLayerError = (MakeWeightsWithoutBias(m_nn.m_weights[currentLayerIndex + 1]).Transpose())
-                * m_gradients[currentLayerIndex + 1];
-            // Посчитаем градиенты на текущем слое.
-            // Вектор градиентов текущего слоя - это произведение
-            // вектора ошибок текущего слоя и вектора производных
-            // от выходного вектора текущего слоя
-            m_gradients[currentLayerIndex] = currentLayerError
-                * (m_outputs[currentLayerIndex].ApplyFunction(GetFunctionDerivative(m_nn.m_layers[currentLayerIndex].fn)));
-            m_vx[currentLayerIndex] = m_momentum * m_vx[currentLayerIndex] + m_gradients[currentLayerIndex];
-            // Проходим по весам каждого нейрона текущего слоя
-            for (std::size_t i = 0; i < m_nn.m_weights[currentLayerIndex].Rows(); i++) {
-                // Вектор величин корректировки - это произведение вектора выходов предыдущего слоя,
-                // градиента текущего нейрона и скорости обучения.
-                // Уменьшаем вектор весов текущего нейрона на вектор с величинами корректировки
-                m_nn.m_weights[currentLayerIndex][i] -= NeuralNetwork::VectorWithBias(
-                        m_outputs[currentLayerIndex - 1], m_nn.m_layers[currentLayerIndex].bias)
-                    * m_vx[currentLayerIndex][i] * m_learningRate;
-            }
-        }
-
-        // Посчитаем вектор ошибок первого слоя - это произведение
-        // транспонированной матрицы весов следующего слоя
-        // и вектора градиентов следующего слоя
-        auto inputLayerError = (MakeWeightsWithoutBias(m_nn.m_weights[1]).Transpose())
-            * m_gradients[1];
-        // Посчитаем градиенты на первом слое.
-        // Вектор градиентов первого слоя - это произведение
-        // вектора ошибок первого слоя и вектора производных
-        // от выходного вектора первого слоя
-        m_gradients[0] = inputLayerError
-            * (m_outputs[0].ApplyFunction(GetFunctionDerivative(m_nn.m_layers[0].fn)));
-        m_vx[0] = m_momentum * m_vx[0] + m_gradients[0];
-        // Проходим по весам каждого нейрона первого слоя
-        for (std::size_t i = 0; i < m_nn.m_weights[0].Rows(); i++) {
-            // Вектор величин корректировки - это произведение вектора входных данных,
-            // градиента текущего нейрона и скорости обучения.
-            // Уменьшаем вектор весов текущего нейрона на вектор с величинами корректировки
-            m_nn.m_weights[0][i] -= NeuralNetwork::VectorWithBias(input, m_nn.m_layers[0].bias)
-                * m_vx[0][i] * m_learningRate;
-        }
-        // Обратный проход завершён
-        // Посчитаем общую ошибку. Это будет среднеквадратичная ошибка.
-        double error = 0.0;
-        // Проходим по вектору выходных ошибок
-        for (std::size_t i = 0; i < outputError.Size(); i++) {
-            // Аккумулируем половину квадрата текущего элемента
-            error += (outputError[i] * outputError[i]);
+        for (std::size_t i = 0; i < m_nn.LayersCount(); i++) {
+            if (m_profiler != nullptr) {
+                m_profilerThreads = 1;
+                m_profiler->Begin();
+            }
+            ForwardLayer(LayerInput(input, i), i);
+            if (m_profiler != nullptr) {
+                m_profiler->End(i, ProfilePhase::Forward, m_profilerThreads);
+            }
+            TrackMemory();
+            // До последней контрольной точки состояние предыдущего слоя больше не нужно,
+            // его выход остаётся, только если это контрольная точка
+            if (checkpointing && i > 0 && i - 1 < m_tail) {
+                Release(i - 1, !m_checkpoints[i]);
+            }
+        }
+        // Посчитаем ошибку на выходе сети и градиенты на последнем слое
+        const double error = OutputGradients(output);
+        TrackMemory();
+        // Проходим по слоям от большего к меньшему, те двигаемся обратно,
+        // от выходного слоя к входному
+        for (std::size_t layer = m_nn.LayersCount(); layer-- > 0;) {
+            if (m_profiler != nullptr) {
+                m_profilerThreads = 1;
+                m_profiler->Begin();
+            }
+            // Последний слой отрезка между контрольными точками:
+            // восстанавливаем состояния слоёв отрезка
+            if (checkpointing && layer < m_tail && m_checkpoints[layer + 1]) {
+                Recompute(input, layer);
+            }
+            if (layer + 1 != m_nn.LayersCount()) {
+                // Вектор градиентов слоя - это произведение
+                // вектора ошибок слоя и вектора производных
+                // от выходного вектора слоя
+                MultiplyByDerivative(layer);
+            }
+            const Vector& layerInput = LayerInput(input, layer);
+            // Корректируем веса текущего слоя
+            UpdateWeights(layerInput, layer);
+            if (layer > 0) {
+                // Посчитаем вектор ошибок предыдущего слоя
+                // по градиентам текущего слоя
+                m_gradients[layer - 1] = BackwardError(layerInput, layer);
+                TrackMemory();
+            }
+            if (checkpointing) {
+                Release(layer, true);
+                m_gradients[layer] = Vector();
+            }
+            if (m_profiler != nullptr) {
+                m_profiler->End(layer, ProfilePhase::Backward, m_profilerThreads);
+            }
+        }
+        // Обратный проход завершён, веса изменились
+        m_nn.Touch();
+        if (m_telemetry != nullptr) {
+            m_telemetry->Push({ m_steps, error, GradientNorm(),
+                std::chrono::duration<double>(Clock::now() - start).count() });
         }
         // Возвращаем общую ошибку
-        return error / outputError.Size();
+        return error;
+    }
+    /**
+     * Установка приёмника телеметрии.
+     * После каждого шага обучения в него добавляется запись с номером шага,
+     * ошибкой, нормой градиента и временем шага.
+     *
+     * \param telemetry Приёмник телеметрии, nullptr - телеметрия отключена
+     */
+    void SetTelemetry(Telemetry* telemetry)
+    {
+        m_telemetry = telemetry;
+    }
+    /**
+     * Установка профилировщика слоёв.
+     * Прямой и обратный проход каждого слоя измеряются отдельно,
+     * вычисление ошибки на выходе сети не измеряется.
+     *
+     * \param profiler Профилировщик, созданный для обучаемой сети, nullptr - профилирование отключено
+     */
+    void SetProfiler(Profiler* profiler)
+    {
+        m_profiler = profiler;
+    }
+    /**
+     * Установка контрольных точек.
+     * Контрольная точка - номер слоя, выход предыдущего слоя (вход этого слоя)
+     * хранится до обратного прохода. Состояния слоёв до последней контрольной точки
+     * освобождаются при прямом проходе и вычисляются повторно при обратном,
+     * состояния слоёв после неё хранятся. Пустой список - обычный режим.
+     *
+     * \param layers Номера слоёв от 1 до количества слоёв - 1
+     */
+    void SetCheckpoints(const std::vector<std::size_t>& layers) noexcept(false)
+    {
+        std::vector<bool> checkpoints;
+        if (!layers.empty()) {
+            checkpoints.assign(m_nn.LayersCount(), false);
+            // Вход сети хранится всегда
+            checkpoints[0] = true;
+            for (const std::size_t layer : layers) {
+                if (layer == 0 || layer >= m_nn.LayersCount()) {
+                    throw std::out_of_range("Checkpoint must be an inner layer boundary");
+                }
+                checkpoints[layer] = true;
+            }
+        }
+        UseCheckpoints(checkpoints);
+    }
+    /**
+     * Выбор контрольных точек по ограничению памяти.
+     * Среди расстановок, укладывающихся в ограничение, выбирается та,
+     * при которой повторно вычисляется меньше всего слоёв: хранимый хвост сети
+     * максимален, остальные слои делятся на отрезки не больше хвоста.
+     *
+     * \param bytes Ограничение памяти состояний слоёв, байт; 0 - обычный режим
+     */
+    void SetMemoryBudget(const std::size_t bytes) noexcept(false)
+    {
+        if (bytes == 0) {
+            UseCheckpoints({});
+            return;
+        }
+        const std::size_t layers = m_nn.LayersCount();
+        for (std::size_t tail = 0; tail < layers; tail++) {
+            std::vector<bool> checkpoints(layers, false);
+            checkpoints[0] = true;
+            checkpoints[tail] = true;
+            std::size_t limit = 0;
+            for (std::size_t layer = tail; layer < layers; layer++) {
+                limit += LayerStateSize(layer);
+            }
+            // Отрезки набираются от хвоста к входу
+            std::size_t segment = 0;
+            for (std::size_t layer = tail; layer-- > 0;) {
+                if (segment > 0 && segment + LayerStateSize(layer) > limit) {
+                    checkpoints[layer + 1] = true;
+                    segment = 0;
+                }
+                segment += LayerStateSize(layer);
+            }
+            if (EstimatePeak(checkpoints) <= bytes) {
+                UseCheckpoints(checkpoints);
+                return;
+            }
+        }
+        throw std::invalid_argument("Memory budget is too small for the network");
+    }
+    /**
+     * Проверка, включён ли режим контрольных точек.
+     * Ограничение памяти может не потребовать повторных вычислений: список контрольных
+     * точек тогда пуст, как и в обычном режиме, но состояния слоёв освобождаются
+     * по ходу обратного прохода и наибольший объём меньше.
+     *
+     * \return true - включён режим контрольных точек
+     */
+    bool Checkpointing() const
+    {
+        return !m_checkpoints.empty();
+    }
+    /**
+     * Получение контрольных точек.
+     *
+     * \return Номера слоёв, входы которых хранятся, кроме входа сети
+     */
+    std::vector<std::size_t> Checkpoints() const
+    {
+        std::vector<std::size_t> result;
+        for (std::size_t layer = 1; layer < m_checkpoints.size(); layer++) {
+            if (m_checkpoints[layer]) {
+                result.push_back(layer);
+            }
+        }
+        return result;
+    }
+    /**
+     * Оценка наибольшего объёма состояний слоёв за шаг обучения
+     * при текущих контрольных точках.
+     *
+     * \return Объём, байт
+     */
+    std::size_t EstimatedPeakMemory() const
+    {
+        return EstimatePeak(m_checkpoints);
+    }
+    /**
+     * Получение отчёта о памяти состояний слоёв на последнем шаге обучения.
+     * Наибольший объём измеряется в режиме контрольных точек,
+     * в обычном режиме он постоянен и вычисляется по размерам слоёв.
+     *
+     * \return Отчёт
+     */
+    TrainerMemoryReport Memory() const
+    {
+        TrainerMemoryReport report = m_memory;
+        // В обычном режиме состояния всех слоёв хранятся всегда, объём равен оценке
+        if (m_checkpoints.empty() && m_steps > 0) {
+            report.peak = EstimatePeak(m_checkpoints);
+        }
+        return report;
+    }
+    /**
+     * Получение количества выполненных шагов обучения.
+     *
+     * \return Количество шагов обучения
+     */
+    std::uint64_t Steps() const
+    {
+        return m_steps;
+    }
+    /**
+     * Получение нормы градиента ошибки по всем весам сети на последнем шаге обучения.
+     *
+     * \return Евклидова норма градиента (без учёта момента)
+     */
+    double GradientNorm() const
+    {
+        return std::sqrt(m_squaredGradientNorm);
     }
     /**
      * Инициализация весов нейронной сети.
@@ -165,6 +360,7 @@ public:
                 }
             }
         }
+        m_nn.Touch();
     }
 private:
     // Ссылка на нейронную сеть
@@ -173,21 +369,387 @@ private:
     double m_learningRate;
     //
     double m_momentum;
+    // Функция потерь
+    LossFunction m_loss;
     //
     std::vector<Vector> m_vx;
+    // Массив матриц, содержащий накопленные изменения весов свёрточных слоёв
+    std::vector<Matrix> m_vw;
     // Массив векторов, содержащий выходные данные слоёв
     std::vector<Vector> m_outputs;
+    // Массив векторов, содержащий взвешенные суммы слоёв (до функции активации)
+    std::vector<Vector> m_sums;
     // Массив векторов, содержащий градиенты слоёв
     std::vector<Vector> m_gradients;
+    // Массив матриц, содержащий развёрнутые входы свёрточных слоёв
+    std::vector<Matrix> m_columns;
+    // Приёмник телеметрии
+    Telemetry* m_telemetry;
+    // Профилировщик слоёв
+    Profiler* m_profiler;
+    // Наибольшее количество потоков ядер умножения в измеряемой фазе слоя
+    std::size_t m_profilerThreads;
+    // Количество выполненных шагов обучения
+    std::uint64_t m_steps;
+    // Квадрат нормы градиента по весам на последнем шаге обучения
+    double m_squaredGradientNorm;
+    // Признаки контрольных точек по номерам слоёв, пустой массив - обычный режим
+    std::vector<bool> m_checkpoints;
+    // Последняя контрольная точка: состояния слоёв начиная с неё не освобождаются
+    std::size_t m_tail;
+    // Отчёт о памяти на последнем шаге обучения
+    TrainerMemoryReport m_memory;
+
+    /**
+     * Включение контрольных точек и освобождение состояний,
+     * оставшихся от предыдущих шагов.
+     *
+     * \param checkpoints Признаки контрольных точек, пустой массив - обычный режим
+     */
+    void UseCheckpoints(const std::vector<bool>& checkpoints)
+    {
+        m_checkpoints = checkpoints;
+        m_tail = 0;
+        for (std::size_t layer = 0; layer < m_checkpoints.size(); layer++) {
+            if (m_checkpoints[layer]) {
+                m_tail = layer;
+            }
+        }
+        for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+            Release(layer, true);
+            m_gradients[layer] = Vector();
+        }
+    }
+
+    static std::size_t CountCheckpoints(const std::vector<bool>& checkpoints)
+    {
+        return static_cast<std::size_t>(std::count(checkpoints.begin() + 1, checkpoints.end(), true));
+    }
+
+    /**
+     * Освобождение состояния слоя.
+     *
+     * \param layer Номер слоя
+     * \param output true - освободить и выход слоя
+     */
+    void Release(const std::size_t layer, const bool output)
+    {
+        m_sums[layer] = Vector();
+        m_columns[layer] = Matrix();
+        if (output) {
+            m_outputs[layer] = Vector();
+        }
+    }
 
-    static Matrix MakeWeightsWithoutBias(const Matrix& input)
+    /**
+     * Повторный прямой проход по отрезку от предыдущей контрольной точки до слоя включительно.
+     * Веса слоёв отрезка ещё не скорректированы, поэтому состояния совпадают с исходными.
+     *
+     * \param input Вектор входных данных сети
+     * \param layer Последний слой отрезка
+     */
+    void Recompute(const Vector& input, const std::size_t layer)
+    {
+        std::size_t first = layer;
+        while (!m_checkpoints[first]) {
+            first--;
+        }
+        for (std::size_t i = first; i <= layer; i++) {
+            ForwardLayer(LayerInput(input, i), i);
+            m_memory.recomputed++;
+            TrackMemory();
+        }
+    }
+
+    /**
+     * Учёт текущего объёма состояний слоёв в наибольшем объёме за шаг.
+     * В обычном режиме объём не меняется от шага к шагу и не измеряется.
+     */
+    void TrackMemory()
+    {
+        if (m_checkpoints.empty()) {
+            return;
+        }
+        std::size_t size = 0;
+        for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+            size += m_outputs[layer].Size() + m_sums[layer].Size() + m_gradients[layer].Size()
+                + m_columns[layer].Rows() * m_columns[layer].Cols();
+        }
+        m_memory.peak = std::max(m_memory.peak, size * sizeof(double));
+    }
+
+    /**
+     * Количество элементов состояния слоя после прямого прохода:
+     * выход, взвешенные суммы и развёрнутый вход свёрточного слоя.
+     *
+     * \param layer Номер слоя
+     * \return Количество элементов
+     */
+    std::size_t LayerStateSize(const std::size_t layer) const
+    {
+        return 2 * OutputSize(layer) + ColumnsSize(layer);
+    }
+
+    std::size_t OutputSize(const std::size_t layer) const
+    {
+        return m_nn.m_shapes[layer + 1].Size();
+    }
+
+    std::size_t ColumnsSize(const std::size_t layer) const
+    {
+        if (m_nn.m_layers[layer].type != LayerType::Convolution) {
+            return 0;
+        }
+        // Столбец на каждое положение окна, положений столько, сколько выходов у одного фильтра
+        const Matrix& weights = m_nn.m_weights[layer];
+        return weights.Cols() * (OutputSize(layer) / weights.Rows());
+    }
+
+    /**
+     * Оценка наибольшего объёма состояний слоёв за шаг обучения.
+     * Повторяет порядок выделения и освобождения состояний в Train.
+     *
+     * \param checkpoints Признаки контрольных точек, пустой массив - обычный режим
+     * \return Объём, байт
+     */
+    std::size_t EstimatePeak(const std::vector<bool>& checkpoints) const
     {
-        Matrix result(input.Rows(), input.Cols() - 1);
-        for (std::size_t row = 0; row < result.Rows(); row++) {
-            for (std::size_t col = 0; col < result.Cols(); col++) {
-                result[row][col] = input[row][col];
+        const std::size_t layers = m_nn.LayersCount();
+        std::size_t size = 0;
+        if (checkpoints.empty()) {
+            // Состояния и градиенты всех слоёв хранятся
+            for (std::size_t layer = 0; layer < layers; layer++) {
+                size += LayerStateSize(layer) + OutputSize(layer);
+            }
+            return size * sizeof(double);
+        }
+        std::size_t tail = 0;
+        for (std::size_t layer = 0; layer < layers; layer++) {
+            if (checkpoints[layer]) {
+                tail = layer;
+            }
+        }
+        std::size_t peak = 0;
+        for (std::size_t layer = 0; layer < layers; layer++) {
+            size += LayerStateSize(layer);
+            peak = std::max(peak, size);
+            if (layer > 0 && layer - 1 < tail) {
+                size -= LayerStateSize(layer - 1) - (checkpoints[layer] ? OutputSize(layer - 1) : 0);
             }
         }
+        // Градиенты последнего слоя
+        size += OutputSize(layers - 1);
+        peak = std::max(peak, size);
+        for (std::size_t layer = layers; layer-- > 0;) {
+            if (layer < tail && checkpoints[layer + 1]) {
+                std::size_t first = layer;
+                while (!checkpoints[first]) {
+                    first--;
+                }
+                for (std::size_t i = first; i <= layer; i++) {
+                    // Выход последнего слоя отрезка уже хранится как контрольная точка
+                    size += LayerStateSize(i) - (i == layer ? OutputSize(i) : 0);
+                    peak = std::max(peak, size);
+                }
+            }
+            if (layer > 0) {
+                size += OutputSize(layer - 1);
+                peak = std::max(peak, size);
+            }
+            size -= LayerStateSize(layer) + OutputSize(layer);
+        }
+        return peak * sizeof(double);
+    }
+
+    /**
+     * Получение входа слоя
+     *
+     * \param input Вектор входных данных сети
+     * \param layer Номер слоя
+     * \return Вектор входных данных слоя
+     */
+    const Vector& LayerInput(const Vector& input, const std::size_t layer) const
+    {
+        return layer == 0 ? input : m_outputs[layer - 1];
+    }
+
+    /**
+     * Прямой проход по слою с сохранением взвешенных сумм и выходных данных
+     *
+     * \param input Вектор входных данных
+     * \param layer Номер слоя
+     */
+    void ForwardLayer(const Vector& input, const std::size_t layer)
+    {
+        if (m_nn.m_layers[layer].type == LayerType::Convolution) {
+            // Развёрнутый вход понадобится при обратном проходе
+            m_columns[layer] = Im2Col(input, m_nn.m_shapes[layer], m_nn.m_layers[layer].window, m_nn.m_layers[layer].bias);
+            m_sums[layer] = m_nn.ConvolutionSums(m_columns[layer], layer);
+        }
+        else {
+            m_sums[layer] = m_nn.Sums(input, layer);
+            if (m_nn.m_layers[layer].type == LayerType::Dense) {
+                m_profilerThreads = std::max(m_profilerThreads, m_nn.m_kernels[layer].threads);
+            }
+        }
+        // При перекрёстной энтропии выход последнего слоя
+        // вычисляется вместе с ошибкой в OutputGradients
+        if (m_loss != LossFunction::CrossEntropy || layer + 1 != m_nn.LayersCount()) {
+            m_outputs[layer] = m_nn.Activate(m_sums[layer], layer);
+        }
+    }
+
+    /**
+     * Вычисление ошибки на выходе сети и градиентов последнего слоя
+     *
+     * \param output Вектор желаемых выходных данных
+     * \return Ошибка
+     */
+    double OutputGradients(const Vector& output)
+    {
+        const std::size_t lastLayerIndex = m_nn.LayersCount() - 1;
+        if (m_loss == LossFunction::CrossEntropy) {
+            // Выход слоя, ошибка и градиенты p - y считаются за один проход по логитам,
+            // производная функции активации отдельно не вычисляется
+            const std::size_t size = m_sums[lastLayerIndex].Size();
+            if (output.Size() != size) {
+                throw std::out_of_range("Vectors must be the same size");
+            }
+            m_outputs[lastLayerIndex] = Vector(size);
+            m_gradients[lastLayerIndex] = Vector(size);
+            return CrossEntropyWithGradient(m_nn.m_layers[lastLayerIndex].fn,
+                m_sums[lastLayerIndex].Data(), output.Data(),
+                m_outputs[lastLayerIndex].Data(), m_gradients[lastLayerIndex].Data(), size);
+        }
+        // Ошибка на выходе - это разность между выходом сети и желаемым выходом
+        const Vector outputError = m_outputs[lastLayerIndex] - output;
+        // Вектор градиентов последнего слоя - это произведение
+        // вектора ошибок последнего слоя и вектора производных
+        // от выходного вектора последнего слоя
+        m_gradients[lastLayerIndex] = outputError;
+        MultiplyByDerivative(lastLayerIndex);
+        // Посчитаем общую ошибку. Это будет среднеквадратичная ошибка.
+        double error = 0.0;
+        // Проходим по вектору выходных ошибок
+        for (std::size_t i = 0; i < outputError.Size(); i++) {
+            // Аккумулируем квадрат текущего элемента
+            error += (outputError[i] * outputError[i]);
+        }
+        return error / outputError.Size();
+    }
+
+    /**
+     * Умножение вектора ошибок слоя на производную функции активации
+     *
+     * \param layer Номер слоя
+     */
+    void MultiplyByDerivative(const std::size_t layer)
+    {
+        // У слоя подвыборки функции активации нет
+        if (m_nn.m_layers[layer].type == LayerType::MaxPooling) {
+            return;
+        }
+        NN::MultiplyByDerivative(m_nn.m_layers[layer].fn,
+            m_sums[layer].Data(), m_outputs[layer].Data(), m_gradients[layer].Data(), m_gradients[layer].Size());
+    }
+
+    /**
+     * Корректировка весов слоя
+     *
+     * \param input Вектор входных данных слоя
+     * \param layer Номер слоя
+     */
+    void UpdateWeights(const Vector& input, const std::size_t layer)
+    {
+        Matrix& weights = m_nn.m_weights[layer];
+        switch (m_nn.m_layers[layer].type) {
+        case LayerType::Dense:
+            {
+                m_vx[layer] = m_momentum * m_vx[layer] + m_gradients[layer];
+                const Vector inputWithBias = NeuralNetwork::VectorWithBias(input, m_nn.m_layers[layer].bias);
+                // Градиент по весам - внешнее произведение градиентов слоя на вход,
+                // его норма - произведение норм
+                m_squaredGradientNorm += (m_gradients[layer] ^ m_gradients[layer]) * (inputWithBias ^ inputWithBias);
+                // Строка матрицы весов - это веса отдельного нейрона
+                // Проходим по весам каждого нейрона слоя
+                for (std::size_t i = 0; i < weights.Rows(); i++) {
+                    // Вектор величин корректировки - это произведение вектора входов слоя,
+                    // градиента текущего нейрона и скорости обучения.
+                    // Уменьшаем вектор весов текущего нейрона на вектор с величинами корректировки
+                    weights[i] -= inputWithBias * m_vx[layer][i] * m_learningRate;
+                }
+            }
+            break;
+        case LayerType::Convolution:
+            {
+                // Градиент по весам фильтров - это произведение матрицы градиентов
+                // (фильтр x положение окна) на транспонированный развёрнутый вход
+                const Matrix gradient = MultiplyByTransposed(GradientMatrix(layer), m_columns[layer]);
+                for (std::size_t i = 0; i < weights.Rows(); i++) {
+                    m_squaredGradientNorm += gradient[i] ^ gradient[i];
+                    m_vw[layer][i] = m_momentum * m_vw[layer][i] + gradient[i];
+                    weights[i] -= m_vw[layer][i] * m_learningRate;
+                }
+            }
+            break;
+        case LayerType::MaxPooling:
+            break;
+        }
+    }
+
+    /**
+     * Вычисление вектора ошибок входа слоя по градиентам слоя
+     *
+     * \param input Вектор входных данных слоя
+     * \param layer Номер слоя
+     * \return Вектор ошибок входа слоя (выхода предыдущего слоя)
+     */
+    Vector BackwardError(const Vector& input, const std::size_t layer) const
+    {
+        const auto& config = m_nn.m_layers[layer];
+        switch (config.type) {
+        case LayerType::Convolution:
+            // Ошибка развёрнутого входа - это произведение транспонированной
+            // матрицы весов на матрицу градиентов. Сворачиваем её обратно во вход
+            return Col2Im(TransposedMultiply(m_nn.m_weights[layer], GradientMatrix(layer)),
+                m_nn.m_shapes[layer], config.window);
+        case LayerType::MaxPooling:
+            return MaxPoolBackward(input, m_gradients[layer], m_nn.m_shapes[layer], config.window);
+        default:
+            {
+                // Вектор ошибок - это произведение
+                // транспонированной матрицы весов слоя (без весов нейрона смещения)
+                // и вектора градиентов слоя. Строки матрицы весов проходятся подряд,
+                // без построения транспонированной копии
+                const Matrix& weights = m_nn.m_weights[layer];
+                Vector result(weights.Cols() - 1);
+                for (std::size_t row = 0; row < weights.Rows(); row++) {
+                    const double gradient = m_gradients[layer][row];
+                    const double* w = weights[row].Data();
+                    for (std::size_t col = 0; col < result.Size(); col++) {
+                        result[col] += w[col] * gradient;
+                    }
+                }
+                return result;
+            }
+        }
+    }
+
+    /**
+     * Представление градиентов свёрточного слоя в виде матрицы (фильтр x положение окна)
+     *
+     * \param layer Номер слоя
+     * \return Матрица градиентов
+     */
+    Matrix GradientMatrix(const std::size_t layer) const
+    {
+        const std::size_t filters = m_nn.m_weights[layer].Rows();
+        const std::size_t positions = m_gradients[layer].Size() / filters;
+        Matrix result(filters, positions);
+        for (std::size_t filter = 0; filter < filters; filter++) {
+            std::copy(m_gradients[layer].Data() + filter * positions,
+                m_gradients[layer].Data() + (filter + 1) * positions, result[filter].Data());
+        }
         return result;
     }
 };
@@ -0,0 +1,565 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+#include "LossFunctions.hpp"
+#include "RingBuffer.hpp"
+
+namespace NN
+{
+
+/**
+ * Порядок прямых и обратных проходов микропакетов на стадии конвейера.
+ */
+enum class PipelineSchedule
+{
+    GPipe,                  // Сначала прямые проходы всех микропакетов, затем все обратные
+    OneForwardOneBackward   // 1F1B: после разгона прямой и обратный проходы чередуются
+};
+
+/**
+ * Структура, описывающая работу одной стадии конвейера.
+ */
+struct PipelineStageReport
+{
+    // Номер первого слоя стадии
+    std::size_t firstLayer;
+    // Номер слоя, следующего за последним слоем стадии
+    std::size_t lastLayer;
+    // Время вычислений в секундах (без ожидания соседних стадий)
+    double busy;
+    // Доля времени обучения, занятая вычислениями
+    double utilization;
+};
+
+/**
+ * Структура, описывающая результат обучения.
+ */
+struct PipelineReport
+{
+    // Стадии
+    std::vector<PipelineStageReport> stages;
+    // Количество микропакетов
+    std::size_t microBatches;
+    // Количество обучающих примеров
+    std::size_t samples;
+    // Время обучения в секундах
+    double seconds;
+    // Средняя ошибка по всем примерам
+    double error;
+
+    /**
+     * Получение доли простоя конвейера.
+     *
+     * \return Доля времени стадий, потраченная на ожидание
+     */
+    double Bubble() const
+    {
+        double utilization = 0.0;
+        for (const auto& stage : stages) {
+            utilization += stage.utilization;
+        }
+        return stages.empty() ? 0.0 : 1.0 - utilization / stages.size();
+    }
+};
+
+/**
+ * Класс, реализующий обучение нейронной сети конвейером потоков.
+ * Слои делятся на непрерывные диапазоны (стадии) с примерно равным количеством весов,
+ * каждую стадию обрабатывает свой поток, поэтому в кэше ядра находятся только её веса.
+ * Обучающие данные делятся на пакеты, пакеты - на микропакеты.
+ * Выходы стадии передаются следующей стадии, ошибки - предыдущей,
+ * через ограниченные очереди номеров микропакетов.
+ * Градиенты микропакетов накапливаются, и после обратного прохода последнего микропакета
+ * пакета стадия корректирует свои веса средним градиентом с моментом,
+ * поэтому все микропакеты пакета используют одни и те же веса (синхронный конвейер).
+ * Поддерживаются только полносвязные слои.
+ */
+class PipelineTrainer
+{
+    // Стадия конвейера
+    struct Stage
+    {
+        // Первый слой и слой, следующий за последним
+        std::size_t first;
+        std::size_t last;
+        // Накопленные градиенты по весам слоёв стадии
+        std::vector<Matrix> gradients;
+        // Накопленные изменения весов (момент)
+        std::vector<Matrix> velocities;
+        // Взвешенные суммы и выходы слоёв: [микропакет][пример][слой стадии]
+        std::vector<std::vector<std::vector<Vector>>> sums;
+        std::vector<std::vector<std::vector<Vector>>> outputs;
+        // Время вычислений
+        double busy;
+    };
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть для обучения
+     * \param stages Количество стадий (потоков), не больше количества слоёв
+     * \param learningRate Скорость обучения
+     * \param momentum Момент
+     * \param loss Функция потерь
+     */
+    PipelineTrainer(
+        NeuralNetwork& nn,
+        const std::size_t stages,
+        const double learningRate,
+        const double momentum,
+        const LossFunction loss = LossFunction::MeanSquaredError) noexcept(false):
+        m_nn(nn),
+        m_learningRate(learningRate),
+        m_momentum(momentum),
+        m_loss(loss),
+        m_schedule(PipelineSchedule::OneForwardOneBackward),
+        m_microBatches(4),
+        m_microBatchSize(8),
+        m_stages(stages),
+        m_failed(false)
+    {
+        if (stages == 0 || stages > nn.LayersCount()) {
+            throw std::invalid_argument("Number of stages must be between 1 and the number of layers");
+        }
+        for (const auto& layer : nn.m_layers) {
+            if (layer.type != LayerType::Dense) {
+                throw std::invalid_argument("Pipeline trainer supports only dense layers");
+            }
+        }
+        if (m_loss == LossFunction::CrossEntropy && !SupportsCrossEntropy(nn.m_layers.back().fn)) {
+            throw std::invalid_argument("Cross-entropy requires softmax or sigmoid output layer");
+        }
+        Partition();
+    }
+    /**
+     * Установка порядка проходов.
+     *
+     * \param schedule Порядок проходов
+     */
+    void SetSchedule(const PipelineSchedule schedule)
+    {
+        m_schedule = schedule;
+    }
+    /**
+     * Установка размеров пакета.
+     * Веса корректируются после каждых microBatches * microBatchSize примеров.
+     *
+     * \param microBatches Количество микропакетов в пакете
+     * \param microBatchSize Количество примеров в микропакете
+     */
+    void SetMicroBatches(const std::size_t microBatches, const std::size_t microBatchSize) noexcept(false)
+    {
+        if (microBatches == 0 || microBatchSize == 0) {
+            throw std::invalid_argument("Micro-batch count and size must be non-zero");
+        }
+        m_microBatches = microBatches;
+        m_microBatchSize = microBatchSize;
+    }
+    /**
+     * Получение диапазона слоёв стадии.
+     *
+     * \param stage Номер стадии
+     * \return Номер первого слоя и номер слоя, следующего за последним
+     */
+    std::pair<std::size_t, std::size_t> StageLayers(const std::size_t stage) const
+    {
+        return { m_stages.at(stage).first, m_stages.at(stage).last };
+    }
+    /**
+     * Обучение нейронной сети на массиве примеров.
+     *
+     * \param inputs Массив векторов входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \return Результат обучения
+     */
+    PipelineReport Train(const std::vector<Vector>& inputs, const std::vector<Vector>& outputs) noexcept(false)
+    {
+        if (inputs.size() != outputs.size()) {
+            throw std::invalid_argument("Number of inputs and outputs must be equal");
+        }
+        // Ошибки размеров проверяем здесь, в потоках стадий их некому обработать
+        for (std::size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].Size() != m_nn.LayerShape(0).Size() || outputs[i].Size() != m_nn.LayerShape(m_nn.LayersCount()).Size()) {
+                throw std::out_of_range("Size of input or output does not match the network");
+            }
+        }
+        m_inputs = &inputs;
+        m_outputs = &outputs;
+        m_error = 0.0;
+        m_failed.store(false);
+        m_exception = nullptr;
+        Prepare();
+
+        std::vector<std::thread> threads;
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t stage = 0; stage < m_stages.size(); stage++) {
+            threads.emplace_back(&PipelineTrainer::Run, this, stage);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // Стадии изменяли веса в своих потоках, версию меняем один раз после их завершения
+        m_nn.Touch();
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+
+        PipelineReport report{ {}, 0, inputs.size(), seconds, inputs.empty() ? 0.0 : m_error / inputs.size() };
+        const std::size_t batch = m_microBatches * m_microBatchSize;
+        report.microBatches = (inputs.size() / batch) * m_microBatches
+            + (inputs.size() % batch + m_microBatchSize - 1) / m_microBatchSize;
+        for (const auto& stage : m_stages) {
+            report.stages.push_back({ stage.first, stage.last, stage.busy, seconds > 0.0 ? stage.busy / seconds : 0.0 });
+        }
+        return report;
+    }
+private:
+    // Ссылка на нейронную сеть
+    NeuralNetwork& m_nn;
+    // Скорость обучения
+    double m_learningRate;
+    // Момент
+    double m_momentum;
+    // Функция потерь
+    LossFunction m_loss;
+    // Порядок проходов
+    PipelineSchedule m_schedule;
+    // Количество микропакетов в пакете
+    std::size_t m_microBatches;
+    // Количество примеров в микропакете
+    std::size_t m_microBatchSize;
+    // Стадии
+    std::vector<Stage> m_stages;
+    // Входы стадий: [стадия][микропакет][пример], у первой стадии не используется
+    std::vector<std::vector<std::vector<Vector>>> m_activations;
+    // Ошибки выходов стадий: [стадия][микропакет][пример], у последней стадии не используется
+    std::vector<std::vector<std::vector<Vector>>> m_errors;
+    // Очереди номеров микропакетов: прямые - от стадии к следующей, обратные - от стадии к предыдущей
+    std::vector<std::unique_ptr<RingBuffer<std::size_t>>> m_forward;
+    std::vector<std::unique_ptr<RingBuffer<std::size_t>>> m_backward;
+    // Обучающие данные
+    const std::vector<Vector>* m_inputs = nullptr;
+    const std::vector<Vector>* m_outputs = nullptr;
+    // Суммарная ошибка (вычисляет последняя стадия)
+    double m_error = 0.0;
+    // Признак ошибки в одном из потоков и её исключение
+    std::atomic<bool> m_failed;
+    std::exception_ptr m_exception;
+
+    /**
+     * Разбиение слоёв на стадии с примерно равным количеством весов.
+     */
+    void Partition()
+    {
+        const std::size_t layers = m_nn.LayersCount();
+        std::vector<std::size_t> prefix(layers + 1, 0);
+        for (std::size_t layer = 0; layer < layers; layer++) {
+            prefix[layer + 1] = prefix[layer] + m_nn.m_weights[layer].Rows() * m_nn.m_weights[layer].Cols();
+        }
+        std::size_t first = 0;
+        for (std::size_t stage = 0; stage < m_stages.size(); stage++) {
+            const std::size_t remaining = m_stages.size() - stage - 1;
+            const std::size_t target = prefix[layers] * (stage + 1) / m_stages.size();
+            // Каждой стадии - хотя бы один слой
+            std::size_t last = first + 1;
+            while (last < layers - remaining && prefix[last] < target) {
+                last++;
+            }
+            // Граница, ближайшая к равному делению, может быть и перед слоем, на котором оно достигнуто.
+            // Если поиск остановлен ограничением на оставшиеся слои, равное деление не достигнуто
+            // и граница остаётся на месте
+            if (last > first + 1 && prefix[last] >= target
+                && target - prefix[last - 1] < prefix[last] - target) {
+                last--;
+            }
+            m_stages[stage].first = first;
+            m_stages[stage].last = last;
+            first = last;
+        }
+        m_stages.back().last = layers;
+    }
+
+    /**
+     * Выделение памяти стадий и очередей под текущие размеры пакета.
+     */
+    void Prepare()
+    {
+        const std::size_t count = m_stages.size();
+        m_activations.assign(count, std::vector<std::vector<Vector>>(m_microBatches, std::vector<Vector>(m_microBatchSize)));
+        m_errors.assign(count, std::vector<std::vector<Vector>>(m_microBatches, std::vector<Vector>(m_microBatchSize)));
+        m_forward.clear();
+        m_backward.clear();
+        for (std::size_t stage = 0; stage < count; stage++) {
+            // В очереди не бывает больше номеров, чем микропакетов в пакете
+            m_forward.push_back(std::make_unique<RingBuffer<std::size_t>>(m_microBatches));
+            m_backward.push_back(std::make_unique<RingBuffer<std::size_t>>(m_microBatches));
+            Stage& s = m_stages[stage];
+            const std::size_t layers = s.last - s.first;
+            s.gradients.resize(layers);
+            s.velocities.resize(layers);
+            for (std::size_t i = 0; i < layers; i++) {
+                const Matrix& weights = m_nn.m_weights[s.first + i];
+                s.gradients[i] = Matrix(weights.Rows(), weights.Cols());
+                if (s.velocities[i].Rows() != weights.Rows() || s.velocities[i].Cols() != weights.Cols()) {
+                    s.velocities[i] = Matrix(weights.Rows(), weights.Cols());
+                }
+            }
+            s.sums.assign(m_microBatches, std::vector<std::vector<Vector>>(m_microBatchSize, std::vector<Vector>(layers)));
+            s.outputs.assign(m_microBatches, std::vector<std::vector<Vector>>(m_microBatchSize, std::vector<Vector>(layers)));
+            s.busy = 0.0;
+        }
+    }
+
+    /**
+     * Цикл потока стадии.
+     *
+     * \param stage Номер стадии
+     */
+    void Run(const std::size_t stage)
+    {
+        try {
+            const std::size_t samples = m_inputs->size();
+            const std::size_t batch = m_microBatches * m_microBatchSize;
+            for (std::size_t begin = 0; begin < samples; begin += batch) {
+                const std::size_t size = std::min(batch, samples - begin);
+                const std::size_t microBatches = (size + m_microBatchSize - 1) / m_microBatchSize;
+                // Количество прямых проходов до первого обратного:
+                // столько микропакетов одновременно находится в стадиях после этой
+                const std::size_t warmup = m_schedule == PipelineSchedule::GPipe ? microBatches
+                    : std::min(m_stages.size() - stage - 1, microBatches);
+                for (std::size_t m = 0; m < warmup; m++) {
+                    Forward(stage, begin, m);
+                }
+                for (std::size_t m = warmup; m < microBatches; m++) {
+                    Forward(stage, begin, m);
+                    Backward(stage, begin, m - warmup);
+                }
+                for (std::size_t m = microBatches - warmup; m < microBatches; m++) {
+                    Backward(stage, begin, m);
+                }
+                Update(stage, size);
+            }
+        }
+        catch (...) {
+            // Первое исключение сохраняем, остальные потоки перестают ждать
+            if (!m_failed.exchange(true)) {
+                m_exception = std::current_exception();
+            }
+        }
+    }
+
+    /**
+     * Ожидание микропакета от соседней стадии.
+     * Соседние стадии обрабатывают микропакеты в одном порядке,
+     * поэтому полученный номер совпадает с ожидаемым.
+     *
+     * \param queue Очередь
+     * \param m Номер ожидаемого микропакета
+     */
+    void Receive(RingBuffer<std::size_t>& queue, const std::size_t m) const noexcept(false)
+    {
+        std::size_t received;
+        while (!queue.TryPop(received)) {
+            if (m_failed.load(std::memory_order_relaxed)) {
+                throw std::runtime_error("Pipeline stage failed");
+            }
+            std::this_thread::yield();
+        }
+        if (received != m) {
+            throw std::logic_error("Pipeline stages are out of order");
+        }
+    }
+
+    static void Send(RingBuffer<std::size_t>& queue, const std::size_t m)
+    {
+        while (!queue.TryPush(m)) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Прямой проход микропакета по слоям стадии.
+     *
+     * \param stage Номер стадии
+     * \param begin Номер первого примера пакета
+     * \param m Номер микропакета в пакете
+     */
+    void Forward(const std::size_t stage, const std::size_t begin, const std::size_t m)
+    {
+        if (stage > 0) {
+            Receive(*m_forward[stage - 1], m);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        Stage& s = m_stages[stage];
+        const bool lastStage = stage + 1 == m_stages.size();
+        const std::size_t count = MicroBatchSize(begin, m);
+        for (std::size_t k = 0; k < count; k++) {
+            for (std::size_t layer = s.first; layer < s.last; layer++) {
+                const std::size_t i = layer - s.first;
+                const Vector& input = i == 0 ? StageInput(stage, begin, m, k) : s.outputs[m][k][i - 1];
+                s.sums[m][k][i] = m_nn.Sums(input, layer);
+                // При перекрёстной энтропии выход последнего слоя вычисляется вместе с ошибкой
+                if (m_loss != LossFunction::CrossEntropy || layer + 1 != m_nn.LayersCount()) {
+                    s.outputs[m][k][i] = m_nn.Activate(s.sums[m][k][i], layer);
+                }
+            }
+            if (!lastStage) {
+                m_activations[stage + 1][m][k] = s.outputs[m][k].back();
+            }
+        }
+        s.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!lastStage) {
+            Send(*m_forward[stage], m);
+        }
+    }
+
+    /**
+     * Обратный проход микропакета по слоям стадии с накоплением градиентов.
+     *
+     * \param stage Номер стадии
+     * \param begin Номер первого примера пакета
+     * \param m Номер микропакета в пакете
+     */
+    void Backward(const std::size_t stage, const std::size_t begin, const std::size_t m)
+    {
+        const bool lastStage = stage + 1 == m_stages.size();
+        if (!lastStage) {
+            Receive(*m_backward[stage + 1], m);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        Stage& s = m_stages[stage];
+        const std::size_t count = MicroBatchSize(begin, m);
+        Vector gradient;
+        for (std::size_t k = 0; k < count; k++) {
+            const std::size_t last = s.last - s.first - 1;
+            if (lastStage) {
+                gradient = OutputGradients(s, m, k, (*m_outputs)[begin + m * m_microBatchSize + k]);
+            }
+            else {
+                gradient = m_errors[stage][m][k];
+                MultiplyByDerivative(s, s.last - 1, m, k, gradient);
+            }
+            for (std::size_t i = last + 1; i-- > 0;) {
+                const std::size_t layer = s.first + i;
+                const Vector& input = i == 0 ? StageInput(stage, begin, m, k) : s.outputs[m][k][i - 1];
+                const Matrix& weights = m_nn.m_weights[layer];
+                const double bias = m_nn.m_layers[layer].bias;
+                // Градиент по весам - внешнее произведение градиентов слоя на вход с нейроном смещения
+                Matrix& accumulated = s.gradients[i];
+                for (std::size_t row = 0; row < weights.Rows(); row++) {
+                    double* g = accumulated[row].Data();
+                    for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                        g[col] += gradient[row] * input[col];
+                    }
+                    g[weights.Cols() - 1] += gradient[row] * bias;
+                }
+                if (layer == 0) {
+                    break;
+                }
+                // Ошибка входа слоя - произведение транспонированной матрицы весов без смещения на градиенты
+                Vector error(weights.Cols() - 1);
+                error = 0.0;
+                for (std::size_t row = 0; row < weights.Rows(); row++) {
+                    const double* w = weights[row].Data();
+                    for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                        error[col] += w[col] * gradient[row];
+                    }
+                }
+                if (i == 0) {
+                    m_errors[stage - 1][m][k] = std::move(error);
+                    break;
+                }
+                MultiplyByDerivative(s, layer - 1, m, k, error);
+                gradient = std::move(error);
+            }
+        }
+        s.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (stage > 0) {
+            Send(*m_backward[stage], m);
+        }
+    }
+
+    /**
+     * Корректировка весов стадии средним градиентом пакета.
+     *
+     * \param stage Номер стадии
+     * \param samples Количество примеров в пакете
+     */
+    void Update(const std::size_t stage, const std::size_t samples)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        Stage& s = m_stages[stage];
+        const double scale = 1.0 / samples;
+        for (std::size_t i = 0; i < s.gradients.size(); i++) {
+            Matrix& weights = m_nn.m_weights[s.first + i];
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                double* w = weights[row].Data();
+                double* v = s.velocities[i][row].Data();
+                double* g = s.gradients[i][row].Data();
+                for (std::size_t col = 0; col < weights.Cols(); col++) {
+                    v[col] = m_momentum * v[col] + g[col] * scale;
+                    w[col] -= m_learningRate * v[col];
+                    g[col] = 0.0;
+                }
+            }
+        }
+        s.busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /**
+     * Вычисление ошибки примера и градиентов выходного слоя.
+     *
+     * \return Градиенты по взвешенным суммам выходного слоя
+     */
+    Vector OutputGradients(Stage& s, const std::size_t m, const std::size_t k, const Vector& target)
+    {
+        const std::size_t i = s.last - s.first - 1;
+        const std::size_t layer = s.last - 1;
+        const std::size_t size = s.sums[m][k][i].Size();
+        Vector gradient(size);
+        if (m_loss == LossFunction::CrossEntropy) {
+            s.outputs[m][k][i] = Vector(size);
+            m_error += CrossEntropyWithGradient(m_nn.m_layers[layer].fn,
+                s.sums[m][k][i].Data(), target.Data(), s.outputs[m][k][i].Data(), gradient.Data(), size);
+            return gradient;
+        }
+        double error = 0.0;
+        for (std::size_t j = 0; j < size; j++) {
+            gradient[j] = s.outputs[m][k][i][j] - target[j];
+            error += gradient[j] * gradient[j];
+        }
+        m_error += error / size;
+        MultiplyByDerivative(s, layer, m, k, gradient);
+        return gradient;
+    }
+
+    void MultiplyByDerivative(Stage& s, const std::size_t layer, const std::size_t m, const std::size_t k, Vector& gradient) const
+    {
+        const std::size_t i = layer - s.first;
+        NN::MultiplyByDerivative(m_nn.m_layers[layer].fn,
+            s.sums[m][k][i].Data(), s.outputs[m][k][i].Data(), gradient.Data(), gradient.Size());
+    }
+
+    const Vector& StageInput(const std::size_t stage, const std::size_t begin, const std::size_t m, const std::size_t k) const
+    {
+        return stage == 0 ? (*m_inputs)[begin + m * m_microBatchSize + k] : m_activations[stage][m][k];
+    }
+
+    std::size_t MicroBatchSize(const std::size_t begin, const std::size_t m) const
+    {
+        const std::size_t first = begin + m * m_microBatchSize;
+        return std::min(m_microBatchSize, m_inputs->size() - first);
+    }
+};
+
+}
@@ -0,0 +1,336 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий одновременное обучение популяции нейронных сетей
+ * одинаковой топологии (разные начальные веса и гиперпараметры).
+ * Веса всех сетей хранятся в виде структуры массивов, индекс модели
+ * самый внутренний: элемент [строка][столбец] матрицы весов слоя
+ * для всех моделей лежит в памяти подряд. Все сети обучаются синхронно,
+ * поэтому во внутренних циклах каждая модель занимает отдельную
+ * "дорожку" векторного регистра.
+ */
+class PopulationTrainer
+{
+public:
+    /**
+     * Конструктор.
+     *
+     * \param inputs Количество входов нейронной сети
+     * \param layers Массив с конфигурацией слоёв
+     * \param learningRates Скорости обучения моделей, по одной на модель
+     * \param momentums Моменты моделей, по одному на модель
+     */
+    PopulationTrainer(
+        const std::size_t inputs,
+        const std::vector<LayerConfig>& layers,
+        const std::vector<double>& learningRates,
+        const std::vector<double>& momentums) noexcept(false):
+        m_inputs(inputs),                   // Сохраняем количество входов
+        m_layers(layers),                   // Сохраняем конфигурацию
+        m_models(learningRates.size()),     // Количество моделей соответствует количеству скоростей обучения
+        m_learningRates(learningRates),     // Сохраняем скорости обучения
+        m_momentums(momentums),             // Сохраняем моменты
+        m_weights(layers.size()),
+        m_vx(layers.size()),
+        m_sums(layers.size()),
+        m_outputs(layers.size()),
+        m_gradients(layers.size()),
+        m_inputsWithBias(layers.size())
+    {
+        if (m_models == 0 || m_momentums.size() != m_models) {
+            throw std::invalid_argument("Number of learning rates and momentums must be equal and non-zero");
+        }
+        for (const auto& layer : layers) {
+            // Softmax связывает нейроны слоя между собой, а здесь функции активации
+            // применяются ко всем дорожкам сразу как поэлементные
+            if (layer.fn == ActivationFunction::Softmax) {
+                throw std::invalid_argument("Softmax layers are not supported by population trainer");
+            }
+            if (layer.type != LayerType::Dense) {
+                throw std::invalid_argument("Population trainer supports only dense layers");
+            }
+        }
+        for (std::size_t layer = 0; layer < layers.size(); layer++) {
+            // Количество столбцов матрицы весов - это количество входов слоя и нейрон смещения
+            const std::size_t cols = LayerInputs(layer) + 1;
+            m_weights[layer].assign(layers[layer].neurons * cols * m_models, 0.0);
+            m_vx[layer].assign(layers[layer].neurons * m_models, 0.0);
+            m_sums[layer].assign(layers[layer].neurons * m_models, 0.0);
+            m_outputs[layer].assign(layers[layer].neurons * m_models, 0.0);
+            m_gradients[layer].assign(layers[layer].neurons * m_models, 0.0);
+            m_inputsWithBias[layer].assign(cols * m_models, 0.0);
+        }
+    }
+    /**
+     * Получение количества моделей в популяции.
+     *
+     * \return Количество моделей
+     */
+    std::size_t ModelsCount() const
+    {
+        return m_models;
+    }
+    /**
+     * Установка точности вычисления функций активации.
+     *
+     * \param accuracy Точность
+     */
+    void SetActivationAccuracy(const ActivationAccuracy accuracy)
+    {
+        m_accuracy = accuracy;
+    }
+    /**
+     * Инициализация весов одной модели.
+     *
+     * \param model Номер модели
+     * \param minValue Минимальное значение веса
+     * \param maxValue Максимальное значение веса
+     * \param engine Движок генерации случайных чисел
+     */
+    template<class Engine>
+    void Init(const std::size_t model, const double minValue, const double maxValue, Engine& engine)
+    {
+        std::uniform_real_distribution<double> ds(minValue, maxValue);
+        // Порядок обхода совпадает с NeuralNetworkTrainer::Init,
+        // поэтому при одинаковом движке веса модели совпадут с весами обычной сети
+        for (std::size_t layer = 0; layer < m_layers.size(); layer++) {
+            const std::size_t cols = LayerInputs(layer) + 1;
+            for (std::size_t row = 0; row < m_layers[layer].neurons; row++) {
+                for (std::size_t col = 0; col < cols; col++) {
+                    m_weights[layer][(row * cols + col) * m_models + model] = ds(engine);
+                }
+            }
+        }
+        for (std::size_t layer = 0; layer < m_layers.size(); layer++) {
+            for (std::size_t neuron = 0; neuron < m_layers[layer].neurons; neuron++) {
+                m_vx[layer][neuron * m_models + model] = 0.0;
+            }
+        }
+    }
+    /**
+     * Обучение всех моделей популяции на одной паре входных и выходных данных.
+     *
+     * \param input Вектор входных данных
+     * \param output Вектор желаемых выходных данных
+     * \return Вектор ошибок, по одной на модель
+     */
+    Vector Train(const Vector& input, const Vector& output) noexcept(false)
+    {
+        const std::size_t N = m_models;
+        const std::size_t lastLayerIndex = m_layers.size() - 1;
+        if (input.Size() != m_inputs || output.Size() != m_layers[lastLayerIndex].neurons) {
+            throw std::out_of_range("Size of input or output does not match the network");
+        }
+        // Прямой проход. Первый слой получает одинаковый вход во всех дорожках
+        for (std::size_t col = 0; col < m_inputs; col++) {
+            Broadcast(&m_inputsWithBias[0][col * N], input[col]);
+        }
+        Broadcast(&m_inputsWithBias[0][m_inputs * N], m_layers[0].bias);
+        ForwardLayer(0);
+        for (std::size_t layer = 1; layer < m_layers.size(); layer++) {
+            const std::size_t prev = m_layers[layer - 1].neurons;
+            std::copy(m_outputs[layer - 1].begin(), m_outputs[layer - 1].end(), m_inputsWithBias[layer].begin());
+            Broadcast(&m_inputsWithBias[layer][prev * N], m_layers[layer].bias);
+            ForwardLayer(layer);
+        }
+
+        // Ошибка на выходе сети и градиенты последнего слоя
+        Vector errors(N);
+        errors = 0.0;
+        {
+            const std::size_t neurons = m_layers[lastLayerIndex].neurons;
+            double* out = m_outputs[lastLayerIndex].data();
+            double* grad = m_gradients[lastLayerIndex].data();
+            for (std::size_t neuron = 0; neuron < neurons; neuron++) {
+                const double target = output[neuron];
+                for (std::size_t m = 0; m < N; m++) {
+                    const double error = out[neuron * N + m] - target;
+                    grad[neuron * N + m] = error;
+                    errors[m] += error * error;
+                }
+            }
+            MultiplyByDerivative(lastLayerIndex);
+        }
+        // Обратный проход, от выходного слоя к входному.
+        // Как и в NeuralNetworkTrainer, ошибка слоя считается по уже скорректированным весам следующего слоя
+        for (std::size_t layer = lastLayerIndex + 1; layer-- > 0;) {
+            UpdateLayer(layer);
+            if (layer > 0) {
+                BackwardError(layer);
+                MultiplyByDerivative(layer - 1);
+            }
+        }
+        // Среднеквадратичная ошибка каждой модели
+        for (std::size_t m = 0; m < N; m++) {
+            errors[m] /= output.Size();
+        }
+        return errors;
+    }
+    /**
+     * Получение нейронной сети с весами одной модели.
+     *
+     * \param model Номер модели
+     * \return Нейронная сеть с весами модели
+     */
+    NeuralNetwork Extract(const std::size_t model) const
+    {
+        NeuralNetwork nn(m_inputs, m_layers);
+        for (std::size_t layer = 0; layer < m_layers.size(); layer++) {
+            const std::size_t cols = LayerInputs(layer) + 1;
+            for (std::size_t row = 0; row < m_layers[layer].neurons; row++) {
+                for (std::size_t col = 0; col < cols; col++) {
+                    nn.m_weights[layer][row][col] = m_weights[layer][(row * cols + col) * m_models + model];
+                }
+            }
+        }
+        nn.Touch();
+        return nn;
+    }
+private:
+    // Количество входов
+    std::size_t m_inputs;
+    // Массив с конфигурациями слоёв
+    std::vector<LayerConfig> m_layers;
+    // Количество моделей
+    std::size_t m_models;
+    // Скорости обучения моделей
+    std::vector<double> m_learningRates;
+    // Моменты моделей
+    std::vector<double> m_momentums;
+    // Веса слоёв: [строка][столбец][модель]
+    std::vector<std::vector<double>> m_weights;
+    // Скорости изменения весов: [нейрон][модель]
+    std::vector<std::vector<double>> m_vx;
+    // Взвешенные суммы слоёв: [нейрон][модель]
+    std::vector<std::vector<double>> m_sums;
+    // Выходы слоёв: [нейрон][модель]
+    std::vector<std::vector<double>> m_outputs;
+    // Градиенты слоёв: [нейрон][модель]
+    std::vector<std::vector<double>> m_gradients;
+    // Входы слоёв вместе с нейроном смещения: [вход][модель]
+    std::vector<std::vector<double>> m_inputsWithBias;
+    // Точность вычисления функций активации
+    ActivationAccuracy m_accuracy = ActivationAccuracy::Exact;
+
+    std::size_t LayerInputs(const std::size_t layer) const
+    {
+        return layer == 0 ? m_inputs : m_layers[layer - 1].neurons;
+    }
+
+    void Broadcast(double* lanes, const double value) const
+    {
+        for (std::size_t m = 0; m < m_models; m++) {
+            lanes[m] = value;
+        }
+    }
+
+    /**
+     * Прямой проход по слою для всех моделей.
+     *
+     * \param layer Номер слоя
+     */
+    void ForwardLayer(const std::size_t layer)
+    {
+        const std::size_t N = m_models;
+        const std::size_t cols = LayerInputs(layer) + 1;
+        const double* w = m_weights[layer].data();
+        const double* in = m_inputsWithBias[layer].data();
+        double* out = m_sums[layer].data();
+        for (std::size_t row = 0; row < m_layers[layer].neurons; row++) {
+            double* o = out + row * N;
+            for (std::size_t m = 0; m < N; m++) {
+                o[m] = 0.0;
+            }
+            for (std::size_t col = 0; col < cols; col++) {
+                const double* wc = w + (row * cols + col) * N;
+                const double* x = in + col * N;
+                for (std::size_t m = 0; m < N; m++) {
+                    o[m] += wc[m] * x[m];
+                }
+            }
+        }
+        Activate(m_layers[layer].fn, m_accuracy, m_sums[layer].data(), m_outputs[layer].data(), m_sums[layer].size());
+    }
+
+    /**
+     * Умножение ошибки слоя на производную функции активации.
+     *
+     * \param layer Номер слоя
+     */
+    void MultiplyByDerivative(const std::size_t layer)
+    {
+        NN::MultiplyByDerivative(m_layers[layer].fn,
+            m_sums[layer].data(), m_outputs[layer].data(), m_gradients[layer].data(), m_gradients[layer].size());
+    }
+
+    /**
+     * Вычисление ошибки предыдущего слоя по градиентам текущего.
+     *
+     * \param layer Номер текущего слоя
+     */
+    void BackwardError(const std::size_t layer)
+    {
+        const std::size_t N = m_models;
+        const std::size_t cols = LayerInputs(layer) + 1;
+        const double* w = m_weights[layer].data();
+        const double* grad = m_gradients[layer].data();
+        double* error = m_gradients[layer - 1].data();
+        // Столбец нейрона смещения в ошибку предыдущего слоя не входит
+        for (std::size_t col = 0; col + 1 < cols; col++) {
+            double* e = error + col * N;
+            for (std::size_t m = 0; m < N; m++) {
+                e[m] = 0.0;
+            }
+            for (std::size_t row = 0; row < m_layers[layer].neurons; row++) {
+                const double* wc = w + (row * cols + col) * N;
+                const double* g = grad + row * N;
+                for (std::size_t m = 0; m < N; m++) {
+                    e[m] += wc[m] * g[m];
+                }
+            }
+        }
+    }
+
+    /**
+     * Корректировка весов слоя с учётом момента.
+     *
+     * \param layer Номер слоя
+     */
+    void UpdateLayer(const std::size_t layer)
+    {
+        const std::size_t N = m_models;
+        const std::size_t cols = LayerInputs(layer) + 1;
+        const double* lr = m_learningRates.data();
+        const double* mu = m_momentums.data();
+        const double* grad = m_gradients[layer].data();
+        const double* in = m_inputsWithBias[layer].data();
+        double* vx = m_vx[layer].data();
+        double* w = m_weights[layer].data();
+        for (std::size_t row = 0; row < m_layers[layer].neurons; row++) {
+            double* v = vx + row * N;
+            const double* g = grad + row * N;
+            for (std::size_t m = 0; m < N; m++) {
+                v[m] = mu[m] * v[m] + g[m];
+            }
+            for (std::size_t col = 0; col < cols; col++) {
+                double* wc = w + (row * cols + col) * N;
+                const double* x = in + col * N;
+                for (std::size_t m = 0; m < N; m++) {
+                    wc[m] -= x[m] * v[m] * lr[m];
+                }
+            }
+        }
+    }
+};
+
+}
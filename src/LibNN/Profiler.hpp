@@ -0,0 +1,457 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+
+// Аппаратные счётчики читаются через perf_event_open, который есть только в Linux
+#if defined(__linux__)
+#   define NN_PROFILER_PERF 1
+#   include <cstring>
+#   include <linux/perf_event.h>
+#   include <sys/ioctl.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+namespace NN
+{
+
+/**
+ * Фаза обработки слоя.
+ */
+enum class ProfilePhase
+{
+    Forward,    // Прямой проход
+    Backward    // Обратный проход: корректировка весов и ошибка входа слоя
+};
+
+/**
+ * Аппаратный счётчик.
+ */
+enum class ProfileCounter
+{
+    Cycles,         // Такты процессора
+    Instructions,   // Выполненные инструкции
+    L1Misses,       // Промахи кэша данных первого уровня при чтении
+    LlcMisses,      // Промахи кэша последнего уровня
+    BranchMisses    // Неверно предсказанные переходы
+};
+
+/**
+ * Структура, описывающая накопленные показатели одной фазы слоя.
+ */
+struct LayerProfile
+{
+    // Количество вызовов
+    std::uint64_t calls;
+    // Время в секундах
+    double seconds;
+    // Количество операций с плавающей точкой (оценка по размерам слоя)
+    double flops;
+    // Объём данных в байтах (оценка: каждый операнд читается и записывается один раз)
+    double bytes;
+    // Значения аппаратных счётчиков в порядке ProfileCounter
+    std::array<std::uint64_t, 5> counters;
+    // Наибольшее количество потоков, выполнявших фазу
+    std::size_t threads;
+
+    /**
+     * Получение количества инструкций за такт.
+     *
+     * \return IPC, 0 - если счётчики недоступны
+     */
+    double Ipc() const
+    {
+        const auto cycles = counters[static_cast<std::size_t>(ProfileCounter::Cycles)];
+        return cycles == 0 ? 0.0 : static_cast<double>(counters[static_cast<std::size_t>(ProfileCounter::Instructions)]) / cycles;
+    }
+    /**
+     * Получение арифметической интенсивности.
+     *
+     * \return Количество операций на байт данных
+     */
+    double ArithmeticIntensity() const
+    {
+        return bytes == 0.0 ? 0.0 : flops / bytes;
+    }
+};
+
+/**
+ * Класс, реализующий профилирование слоёв нейронной сети.
+ * Для каждого слоя и фазы накапливает время, аппаратные счётчики
+ * (такты, инструкции, промахи кэшей L1 и последнего уровня, промахи предсказания переходов)
+ * и оценку количества операций и объёма данных. По ним строится отчёт
+ * в духе модели roofline: IPC, достигнутая производительность, арифметическая
+ * интенсивность и, если заданы пиковые характеристики машины, ограничение слоя -
+ * вычислениями или пропускной способностью памяти.
+ * Счётчики считают события только потока, создавшего профилировщик,
+ * поэтому для фаз, выполненных многопоточным ядром умножения, они неполны:
+ * такие строки отчёта помечаются звёздочкой.
+ * Если счётчики недоступны (не Linux, нет PMU в виртуальной машине,
+ * запрещено perf_event_paranoid), профилировщик измеряет только время.
+ */
+class Profiler
+{
+public:
+    /**
+     * Конструктор. Открывает аппаратные счётчики.
+     *
+     * \param nn Нейронная сеть, по слоям которой оцениваются операции и объём данных
+     */
+    explicit Profiler(const NeuralNetwork& nn):
+        m_profiles(nn.LayersCount() * 2),
+        m_costs(nn.LayersCount() * 2),
+        m_layers(nn.LayersCount()),
+        m_peakFlops(0.0),
+        m_bandwidth(0.0),
+        m_leader(-1),
+        m_opened(0),
+        m_begin{}
+    {
+        m_slots.fill(-1);
+        m_descriptors.fill(-1);
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            EstimateCosts(nn, layer);
+        }
+        Open();
+        Reset();
+    }
+    Profiler(const Profiler&) = delete;
+    Profiler& operator = (const Profiler&) = delete;
+    ~Profiler()
+    {
+#if defined(NN_PROFILER_PERF)
+        for (const int fd : m_descriptors) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+    /**
+     * Проверка доступности аппаратного счётчика.
+     *
+     * \param counter Счётчик
+     * \return true, если счётчик открыт
+     */
+    bool Available(const ProfileCounter counter) const
+    {
+        return m_slots[static_cast<std::size_t>(counter)] >= 0;
+    }
+    /**
+     * Задание пиковых характеристик машины для отчёта.
+     *
+     * \param peakGflops Пиковая производительность, ГФЛОП/с
+     * \param bandwidth Пропускная способность памяти, ГБ/с
+     */
+    void SetRoofline(const double peakGflops, const double bandwidth)
+    {
+        m_peakFlops = peakGflops * 1e9;
+        m_bandwidth = bandwidth * 1e9;
+    }
+    /**
+     * Начало измерения фазы слоя.
+     */
+    void Begin()
+    {
+        Read(m_begin);
+        m_start = Clock::now();
+    }
+    /**
+     * Окончание измерения фазы слоя, начатого Begin.
+     *
+     * \param layer Номер слоя
+     * \param phase Фаза
+     * \param threads Количество потоков, выполнявших фазу вместе с вызывающим
+     */
+    void End(const std::size_t layer, const ProfilePhase phase, const std::size_t threads = 1)
+    {
+        const auto end = Clock::now();
+        std::array<std::uint64_t, 5> values;
+        Read(values);
+        LayerProfile& profile = m_profiles[Index(layer, phase)];
+        const LayerProfile& cost = m_costs[Index(layer, phase)];
+        profile.calls++;
+        profile.seconds += std::chrono::duration<double>(end - m_start).count();
+        profile.flops += cost.flops;
+        profile.bytes += cost.bytes;
+        profile.threads = std::max(profile.threads, threads);
+        for (std::size_t i = 0; i < values.size(); i++) {
+            // Неудачное чтение даёт нули, такое измерение счётчиков пропускаем
+            if (values[i] >= m_begin[i]) {
+                profile.counters[i] += values[i] - m_begin[i];
+            }
+        }
+    }
+    /**
+     * Прямой проход по нейронной сети с измерением каждого слоя
+     *
+     * \param nn Нейронная сеть
+     * \param input Вектор входных данных
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const NeuralNetwork& nn, const Vector& input)
+    {
+        if (nn.LayersCount() != m_layers) {
+            throw std::invalid_argument("Network does not match the profiler");
+        }
+        Vector output = input;
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            Begin();
+            output = nn.Forward(output, layer);
+            End(layer, ProfilePhase::Forward, nn.m_layers[layer].type == LayerType::Dense ? nn.m_kernels[layer].threads : 1);
+        }
+        return output;
+    }
+    /**
+     * Получение накопленных показателей фазы слоя.
+     *
+     * \param layer Номер слоя
+     * \param phase Фаза
+     * \return Показатели
+     */
+    const LayerProfile& Profile(const std::size_t layer, const ProfilePhase phase) const
+    {
+        return m_profiles.at(Index(layer, phase));
+    }
+    /**
+     * Сброс накопленных показателей.
+     */
+    void Reset()
+    {
+        for (auto& profile : m_profiles) {
+            profile = { 0, 0.0, 0.0, 0.0, {}, 1 };
+        }
+    }
+    /**
+     * Вывод отчёта по слоям.
+     *
+     * \param out Поток вывода
+     */
+    void Report(std::ostream& out) const
+    {
+        const bool counters = Available(ProfileCounter::Cycles);
+        if (!counters) {
+            out << "Hardware counters are not available, only time is measured\n";
+        }
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << std::fixed << std::setprecision(2)
+            << std::setw(5) << "Layer" << std::setw(10) << "Phase" << std::setw(10) << "Calls"
+            << std::setw(12) << "us/call" << std::setw(10) << "GFLOP/s" << std::setw(10) << "FLOP/B";
+        if (counters) {
+            out << std::setw(8) << "IPC" << std::setw(12) << "L1 miss/KI" << std::setw(12) << "LLC miss/KI" << std::setw(12) << "Br miss/KI";
+        }
+        if (m_peakFlops > 0.0 && m_bandwidth > 0.0) {
+            out << std::setw(10) << "Roof %" << std::setw(10) << "Bound";
+        }
+        out << "\n";
+        bool partial = false;
+        for (std::size_t layer = 0; layer < m_layers; layer++) {
+            for (const auto phase : { ProfilePhase::Forward, ProfilePhase::Backward }) {
+                const LayerProfile& profile = m_profiles[Index(layer, phase)];
+                if (profile.calls == 0) {
+                    continue;
+                }
+                const double intensity = profile.ArithmeticIntensity();
+                const double flops = profile.seconds > 0.0 ? profile.flops / profile.seconds : 0.0;
+                out << std::setw(5) << layer << std::setw(10) << (phase == ProfilePhase::Forward ? "forward" : "backward")
+                    << std::setw(10) << profile.calls
+                    << std::setw(12) << profile.seconds / profile.calls * 1e6
+                    << std::setw(10) << flops * 1e-9
+                    << std::setw(10) << intensity;
+                if (counters) {
+                    out << std::setw(8) << profile.Ipc()
+                        << std::setw(12) << PerKiloInstruction(profile, ProfileCounter::L1Misses)
+                        << std::setw(12) << PerKiloInstruction(profile, ProfileCounter::LlcMisses)
+                        << std::setw(12) << PerKiloInstruction(profile, ProfileCounter::BranchMisses);
+                }
+                if (m_peakFlops > 0.0 && m_bandwidth > 0.0) {
+                    // Достижимая производительность ограничена пиком вычислений
+                    // либо произведением интенсивности на пропускную способность памяти
+                    const double roof = std::min(m_peakFlops, intensity * m_bandwidth);
+                    out << std::setw(10) << (roof > 0.0 ? flops / roof * 100.0 : 0.0)
+                        << std::setw(10) << (intensity * m_bandwidth < m_peakFlops ? "memory" : "compute");
+                }
+                if (counters && profile.threads > 1) {
+                    out << " *";
+                    partial = true;
+                }
+                out << "\n";
+            }
+        }
+        if (partial) {
+            out << "* Counters cover only the calling thread of a multithreaded kernel\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Накопленные показатели: слой * 2 + фаза
+    std::vector<LayerProfile> m_profiles;
+    // Операции и объём данных одного вызова фазы слоя
+    std::vector<LayerProfile> m_costs;
+    // Количество слоёв
+    std::size_t m_layers;
+    // Пиковая производительность, ФЛОП/с
+    double m_peakFlops;
+    // Пропускная способность памяти, байт/с
+    double m_bandwidth;
+    // Дескриптор ведущего счётчика группы
+    int m_leader;
+    // Количество открытых счётчиков
+    std::size_t m_opened;
+    // Номер значения счётчика в группе, -1 - счётчик недоступен
+    std::array<int, 5> m_slots;
+    // Дескрипторы счётчиков
+    std::array<int, 5> m_descriptors;
+    // Значения счётчиков и время в начале измерения
+    std::array<std::uint64_t, 5> m_begin;
+    Clock::time_point m_start;
+
+    static std::size_t Index(const std::size_t layer, const ProfilePhase phase)
+    {
+        return layer * 2 + (phase == ProfilePhase::Forward ? 0 : 1);
+    }
+
+    static double PerKiloInstruction(const LayerProfile& profile, const ProfileCounter counter)
+    {
+        const auto instructions = profile.counters[static_cast<std::size_t>(ProfileCounter::Instructions)];
+        return instructions == 0 ? 0.0 : profile.counters[static_cast<std::size_t>(counter)] * 1000.0 / instructions;
+    }
+
+    /**
+     * Оценка количества операций и объёма данных фаз слоя по его размерам.
+     * Обратный проход включает корректировку весов с моментом и,
+     * кроме первого слоя, вычисление ошибки входа слоя.
+     *
+     * \param nn Нейронная сеть
+     * \param layer Номер слоя
+     */
+    void EstimateCosts(const NeuralNetwork& nn, const std::size_t layer)
+    {
+        const double inputs = static_cast<double>(nn.LayerShape(layer).Size());
+        const double outputs = static_cast<double>(nn.LayerShape(layer + 1).Size());
+        const double error = layer > 0 ? 1.0 : 0.0;
+        LayerProfile& forward = m_costs[Index(layer, ProfilePhase::Forward)];
+        LayerProfile& backward = m_costs[Index(layer, ProfilePhase::Backward)];
+        const double size = sizeof(double);
+        switch (nn.m_layers[layer].type) {
+        case LayerType::Dense:
+            {
+                const double weights = static_cast<double>(nn.m_weights[layer].Rows() * nn.m_weights[layer].Cols());
+                forward.flops = 2.0 * weights;
+                forward.bytes = size * (weights + inputs + outputs);
+                // Корректировка: два умножения и вычитание на вес; ошибка входа: умножение и сложение на вес
+                backward.flops = 3.0 * weights + error * 2.0 * weights;
+                backward.bytes = size * (2.0 * weights + inputs + outputs + error * (weights + inputs));
+            }
+            break;
+        case LayerType::Convolution:
+            {
+                const double filters = static_cast<double>(nn.m_weights[layer].Rows());
+                const double window = static_cast<double>(nn.m_weights[layer].Cols());
+                const double positions = outputs / filters;
+                const double weights = filters * window;
+                forward.flops = 2.0 * weights * positions;
+                forward.bytes = size * (weights + window * positions + outputs);
+                // Градиент по весам и ошибка развёрнутого входа - произведения той же размерности, что прямой проход
+                backward.flops = 2.0 * weights * positions + 3.0 * weights + error * 2.0 * weights * positions;
+                backward.bytes = size * (2.0 * weights + window * positions + outputs + error * (weights + window * positions + inputs));
+            }
+            break;
+        case LayerType::MaxPooling:
+            {
+                // Операции - сравнения внутри окна
+                const double window = static_cast<double>(nn.m_layers[layer].window.size * nn.m_layers[layer].window.size);
+                forward.flops = outputs * window;
+                forward.bytes = size * (inputs + outputs);
+                backward.flops = error * outputs * window;
+                backward.bytes = error * size * (2.0 * inputs + outputs);
+            }
+            break;
+        }
+    }
+
+    /**
+     * Открытие группы аппаратных счётчиков для текущего потока.
+     * Счётчики, не поддерживаемые процессором, пропускаются.
+     */
+    void Open()
+    {
+#if defined(NN_PROFILER_PERF)
+        const std::array<std::pair<std::uint32_t, std::uint64_t>, 5> events = { {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+        } };
+        for (std::size_t i = 0; i < events.size(); i++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = events[i].first;
+            attr.config = events[i].second;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = m_leader < 0 ? 1 : 0;
+            // Без ядра счётчики доступны при perf_event_paranoid <= 2
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            const int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, m_leader, 0));
+            if (fd < 0) {
+                // Без ведущего счётчика тактов группа не создаётся
+                if (m_leader < 0) {
+                    return;
+                }
+                continue;
+            }
+            if (m_leader < 0) {
+                m_leader = fd;
+            }
+            m_descriptors[i] = fd;
+            m_slots[i] = static_cast<int>(m_opened++);
+        }
+        ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    /**
+     * Чтение значений счётчиков группы одним системным вызовом.
+     *
+     * \param values Значения в порядке ProfileCounter, недоступные - 0
+     */
+    void Read(std::array<std::uint64_t, 5>& values) const
+    {
+        values.fill(0);
+#if defined(NN_PROFILER_PERF)
+        if (m_leader < 0) {
+            return;
+        }
+        // Формат PERF_FORMAT_GROUP: количество счётчиков, затем их значения
+        std::array<std::uint64_t, 6> buffer;
+        if (read(m_leader, buffer.data(), sizeof(buffer)) < static_cast<ssize_t>((m_opened + 1) * sizeof(std::uint64_t))) {
+            return;
+        }
+        for (std::size_t i = 0; i < values.size(); i++) {
+            if (m_slots[i] >= 0) {
+                values[i] = buffer[1 + m_slots[i]];
+            }
+        }
+#endif
+    }
+};
+
+}
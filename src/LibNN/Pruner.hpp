@@ -0,0 +1,190 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+#include "NeuralNetworkTrainer.hpp"
+
+namespace NN
+{
+
+/**
+ * Область выбора порога при прореживании.
+ */
+enum class PruningScope
+{
+    Global,     // Общий порог для всех слоёв
+    PerLayer    // Заданная доля весов обнуляется в каждом слое
+};
+
+/**
+ * Класс, реализующий прореживание весов нейронной сети по модулю.
+ * Обнуляются веса с наименьшим модулем; веса нейронов смещения не прореживаются.
+ * Обнулённые веса запоминаются в маске, и при дообучении через Train
+ * остаются нулевыми, поэтому прореживание можно выполнять постепенно,
+ * чередуя его с дообучением.
+ */
+class Pruner
+{
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть для прореживания
+     */
+    explicit Pruner(NeuralNetwork& nn):
+        m_nn(nn),
+        m_masks(nn.LayersCount())
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            const Matrix& weights = nn.m_weights[layer];
+            m_masks[layer] = Matrix(weights.Rows(), weights.Cols());
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                m_masks[layer][row] = 1.0;
+            }
+        }
+    }
+    /**
+     * Прореживание весов.
+     * Уже обнулённые веса учитываются в доле, поэтому повторный вызов
+     * с большей долей обнуляет только недостающие веса.
+     *
+     * \param sparsity Доля обнуляемых весов от 0 до 1
+     * \param scope Область выбора порога
+     */
+    void Prune(const double sparsity, const PruningScope scope = PruningScope::PerLayer) noexcept(false)
+    {
+        if (!(sparsity >= 0.0 && sparsity < 1.0)) {
+            throw std::invalid_argument("Sparsity must be in range [0, 1)");
+        }
+        if (scope == PruningScope::Global) {
+            PruneLayers(0, m_nn.LayersCount(), sparsity);
+        }
+        else {
+            for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+                PruneLayers(layer, layer + 1, sparsity);
+            }
+        }
+        m_nn.Touch();
+    }
+    /**
+     * Дообучение прореженной нейронной сети.
+     * После шага обучения обнулённые веса снова обнуляются.
+     *
+     * \param trainer Обучатель той же нейронной сети
+     * \param input Вектор входных данных
+     * \param output Вектор желаемых выходных данных
+     * \return Ошибка
+     */
+    double Train(NeuralNetworkTrainer& trainer, const Vector& input, const Vector& output)
+    {
+        const double error = trainer.Train(input, output);
+        ApplyMask();
+        return error;
+    }
+    /**
+     * Обнуление весов по маске.
+     */
+    void ApplyMask()
+    {
+        for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+            Matrix& weights = m_nn.m_weights[layer];
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                weights[row] = weights[row] * m_masks[layer][row];
+            }
+        }
+        m_nn.Touch();
+    }
+    /**
+     * Получение доли обнулённых весов во всей сети.
+     *
+     * \return Доля обнулённых весов без учёта весов нейронов смещения
+     */
+    double Sparsity() const
+    {
+        std::size_t zeros = 0, total = 0;
+        for (std::size_t layer = 0; layer < m_nn.LayersCount(); layer++) {
+            Count(layer, zeros, total);
+        }
+        return total == 0 ? 0.0 : static_cast<double>(zeros) / total;
+    }
+    /**
+     * Получение доли обнулённых весов слоя.
+     *
+     * \param layer Номер слоя
+     * \return Доля обнулённых весов без учёта весов нейрона смещения
+     */
+    double Sparsity(const std::size_t layer) const
+    {
+        std::size_t zeros = 0, total = 0;
+        Count(layer, zeros, total);
+        return total == 0 ? 0.0 : static_cast<double>(zeros) / total;
+    }
+private:
+    // Ссылка на нейронную сеть
+    NeuralNetwork& m_nn;
+    // Маски весов: 1 - вес обучается, 0 - вес обнулён
+    std::vector<Matrix> m_masks;
+
+    /**
+     * Прореживание слоёв [first, last) с общим порогом.
+     *
+     * \param first Первый слой
+     * \param last Слой, следующий за последним
+     * \param sparsity Доля обнуляемых весов
+     */
+    void PruneLayers(const std::size_t first, const std::size_t last, const double sparsity)
+    {
+        // Модули всех весов слоёв, кроме весов нейронов смещения (последний столбец)
+        std::vector<double> magnitudes;
+        for (std::size_t layer = first; layer < last; layer++) {
+            const Matrix& weights = m_nn.m_weights[layer];
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                    magnitudes.push_back(std::fabs(weights[row][col]));
+                }
+            }
+        }
+        const std::size_t count = static_cast<std::size_t>(sparsity * magnitudes.size());
+        if (count == 0) {
+            return;
+        }
+        // Порог - модуль веса с номером count в порядке возрастания
+        std::nth_element(magnitudes.begin(), magnitudes.begin() + (count - 1), magnitudes.end());
+        const double threshold = magnitudes[count - 1];
+        // Веса, равные порогу, обнуляются, только пока не набрано нужное количество
+        std::size_t ties = count - std::count_if(magnitudes.begin(), magnitudes.end(),
+            [threshold](const double value) { return value < threshold; });
+        for (std::size_t layer = first; layer < last; layer++) {
+            Matrix& weights = m_nn.m_weights[layer];
+            for (std::size_t row = 0; row < weights.Rows(); row++) {
+                for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                    const double magnitude = std::fabs(weights[row][col]);
+                    if (magnitude < threshold || (magnitude == threshold && ties > 0)) {
+                        if (magnitude == threshold) {
+                            ties--;
+                        }
+                        weights[row][col] = 0.0;
+                        m_masks[layer][row][col] = 0.0;
+                    }
+                }
+            }
+        }
+    }
+
+    void Count(const std::size_t layer, std::size_t& zeros, std::size_t& total) const
+    {
+        const Matrix& weights = m_nn.m_weights[layer];
+        for (std::size_t row = 0; row < weights.Rows(); row++) {
+            for (std::size_t col = 0; col + 1 < weights.Cols(); col++) {
+                zeros += weights[row][col] == 0.0 ? 1 : 0;
+                total++;
+            }
+        }
+    }
+};
+
+}
@@ -0,0 +1,102 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий кольцевой буфер без блокировок
+ * для одного писателя и одного читателя (SPSC).
+ * Писатель изменяет только индекс записи, читатель - только индекс чтения,
+ * индексы лежат в разных строках кэша. Каждая сторона хранит копию
+ * индекса другой стороны и перечитывает его, только когда буфер
+ * по этой копии выглядит заполненным (пустым), поэтому в обычном случае
+ * добавление и извлечение элемента не обращаются к строке кэша другой стороны.
+ */
+template<class T>
+class RingBuffer
+{
+public:
+    /**
+     * Конструктор.
+     *
+     * \param capacity Ёмкость буфера, округляется вверх до степени двойки
+     */
+    explicit RingBuffer(const std::size_t capacity):
+        m_mask(RoundUp(capacity) - 1),
+        m_items(m_mask + 1) {}
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator = (const RingBuffer&) = delete;
+    /**
+     * Добавление элемента. Вызывается только писателем.
+     *
+     * \param item Элемент
+     * \return false, если буфер заполнен и элемент не добавлен
+     */
+    bool TryPush(const T& item)
+    {
+        const std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead > m_mask) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead > m_mask) {
+                return false;
+            }
+        }
+        m_items[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+     * Извлечение элемента. Вызывается только читателем.
+     *
+     * \param item Извлечённый элемент
+     * \return false, если буфер пуст
+     */
+    bool TryPop(T& item)
+    {
+        const std::uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail) {
+                return false;
+            }
+        }
+        item = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+     * Получение ёмкости буфера.
+     *
+     * \return Ёмкость буфера
+     */
+    std::size_t Capacity() const
+    {
+        return m_mask + 1;
+    }
+private:
+    // Маска индекса: ёмкость - 1
+    const std::size_t m_mask;
+    // Элементы
+    std::vector<T> m_items;
+    // Индекс записи и копия индекса чтения (писатель)
+    alignas(64) std::atomic<std::uint64_t> m_tail{ 0 };
+    std::uint64_t m_cachedHead = 0;
+    // Индекс чтения и копия индекса записи (читатель)
+    alignas(64) std::atomic<std::uint64_t> m_head{ 0 };
+    std::uint64_t m_cachedTail = 0;
+
+    static std::size_t RoundUp(const std::size_t capacity)
+    {
+        std::size_t result = 1;
+        while (result < capacity) {
+            result <<= 1;
+        }
+        return result;
+    }
+};
+
+}
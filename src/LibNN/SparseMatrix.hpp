@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "Matrix.hpp"
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий разреженную матрицу в формате CSR (compressed sparse row).
+ * Хранятся только ненулевые элементы: значения и номера столбцов строка за строкой,
+ * и смещения начала каждой строки в этих массивах.
+ * Пример:
+ * [[a11,   0, a13]]     значения: [a11, a13, a22]
+ * [[  0, a22,   0]] ->  столбцы:  [  0,   2,   1]
+ *                       смещения: [0, 2, 3]
+ */
+class SparseMatrix
+{
+public:
+    SparseMatrix() = default;
+    /**
+     * Конструктор. Преобразует плотную матрицу, отбрасывая нулевые элементы.
+     *
+     * \param matrix Плотная матрица
+     */
+    explicit SparseMatrix(const Matrix& matrix):
+        m_cols(matrix.Cols()),
+        m_offsets(matrix.Rows() + 1, 0)
+    {
+        for (std::size_t row = 0; row < matrix.Rows(); row++) {
+            for (std::size_t col = 0; col < m_cols; col++) {
+                if (matrix[row][col] != 0.0) {
+                    m_values.push_back(matrix[row][col]);
+                    m_columns.push_back(static_cast<std::uint32_t>(col));
+                }
+            }
+            m_offsets[row + 1] = m_values.size();
+        }
+    }
+    /**
+     * Получение количества строк.
+     *
+     * \return Количество строк
+     */
+    std::size_t Rows() const
+    {
+        return m_offsets.empty() ? 0 : m_offsets.size() - 1;
+    }
+    /**
+     * Получение количества столбцов.
+     *
+     * \return Количество столбцов
+     */
+    std::size_t Cols() const
+    {
+        return m_cols;
+    }
+    /**
+     * Получение количества ненулевых элементов.
+     *
+     * \return Количество ненулевых элементов
+     */
+    std::size_t NonZeros() const
+    {
+        return m_values.size();
+    }
+    /**
+     * Получение объёма памяти, занимаемого элементами матрицы.
+     *
+     * \return Объём памяти в байтах
+     */
+    std::size_t MemorySize() const
+    {
+        return m_values.size() * sizeof(double)
+            + m_columns.size() * sizeof(std::uint32_t)
+            + m_offsets.size() * sizeof(std::size_t);
+    }
+    /**
+     * Умножение разреженной матрицы на вектор.
+     * Для каждой строки суммируются только произведения ненулевых элементов.
+     *
+     * \param matrix Разреженная матрица
+     * \param vector Вектор
+     * \return Вектор
+     */
+    friend Vector operator * (const SparseMatrix& matrix, const Vector& vector) noexcept(false)
+    {
+        if (matrix.Cols() != vector.Size()) {
+            throw std::out_of_range("Number of columns of matrix must be equal to the size of vector");
+        }
+        Vector result(matrix.Rows());
+        const double* x = vector.Data();
+        const double* values = matrix.m_values.data();
+        const std::uint32_t* columns = matrix.m_columns.data();
+        for (std::size_t row = 0; row < matrix.Rows(); row++) {
+            double sum = 0.0;
+            for (std::size_t i = matrix.m_offsets[row]; i < matrix.m_offsets[row + 1]; i++) {
+                sum += values[i] * x[columns[i]];
+            }
+            result[row] = sum;
+        }
+        return result;
+    }
+    /**
+     * Умножение разреженной матрицы на плотную матрицу.
+     * Строка результата - это сумма строк плотной матрицы
+     * с коэффициентами из ненулевых элементов строки разреженной матрицы.
+     *
+     * \param a Разреженная матрица (MxK)
+     * \param b Плотная матрица (KxN)
+     * \return Матрица (MxN)
+     */
+    friend Matrix operator * (const SparseMatrix& a, const Matrix& b) noexcept(false)
+    {
+        if (a.Cols() != b.Rows()) {
+            throw std::out_of_range("Number of columns of first matrix must be equal to the number of rows of second matrix");
+        }
+        Matrix result(a.Rows(), b.Cols());
+        const std::size_t cols = b.Cols();
+        for (std::size_t row = 0; row < a.Rows(); row++) {
+            double* c = result[row].Data();
+            for (std::size_t i = a.m_offsets[row]; i < a.m_offsets[row + 1]; i++) {
+                const double value = a.m_values[i];
+                const double* source = b[a.m_columns[i]].Data();
+                for (std::size_t j = 0; j < cols; j++) {
+                    c[j] += value * source[j];
+                }
+            }
+        }
+        return result;
+    }
+private:
+    // Количество столбцов
+    std::size_t m_cols = 0;
+    // Ненулевые элементы строка за строкой
+    std::vector<double> m_values;
+    // Номера столбцов ненулевых элементов.
+    // 32-битные номера вдвое сокращают расход памяти на индексы
+    std::vector<std::uint32_t> m_columns;
+    // Смещения начала строк в массивах элементов; последний элемент - количество ненулевых элементов
+    std::vector<std::size_t> m_offsets;
+};
+
+}
@@ -0,0 +1,127 @@
+﻿#pragma once
+
+#include "NeuralNetwork.hpp"
+#include "SparseMatrix.hpp"
+
+namespace NN
+{
+
+/**
+ * Класс, реализующий нейронную сеть с разреженными матрицами весов для прямого прохода.
+ * Создаётся из обученной (как правило, прореженной, см. Pruner) нейронной сети
+ * и хранит только ненулевые веса, поэтому при высокой доле нулевых весов
+ * занимает меньше памяти и быстрее выполняет прямой проход.
+ */
+class SparseNeuralNetwork
+{
+public:
+    /**
+     * Конструктор.
+     *
+     * \param nn Нейронная сеть
+     */
+    explicit SparseNeuralNetwork(const NeuralNetwork& nn):
+        m_weights(nn.LayersCount()),
+        m_layers(nn.m_layers),
+        m_shapes(nn.m_shapes),
+        m_accuracy(nn.m_accuracy),
+        m_denseSize(0)
+    {
+        for (std::size_t layer = 0; layer < nn.LayersCount(); layer++) {
+            m_weights[layer] = SparseMatrix(nn.m_weights[layer]);
+            m_denseSize += nn.m_weights[layer].Rows() * nn.m_weights[layer].Cols() * sizeof(double);
+        }
+    }
+    /**
+     * Получение количества слоёв нейронной сети.
+     *
+     * \return Количество слоёв нейронной сети
+     */
+    std::size_t LayersCount() const
+    {
+        return m_weights.size();
+    }
+    /**
+     * Получение объёма памяти, занимаемого весами.
+     *
+     * \return Объём памяти в байтах
+     */
+    std::size_t MemorySize() const
+    {
+        std::size_t size = 0;
+        for (const auto& weights : m_weights) {
+            size += weights.MemorySize();
+        }
+        return size;
+    }
+    /**
+     * Получение объёма памяти, занимаемого весами исходной нейронной сети.
+     *
+     * \return Объём памяти в байтах
+     */
+    std::size_t DenseMemorySize() const
+    {
+        return m_denseSize;
+    }
+    /**
+     * Прямой проход по нейронной сети
+     *
+     * \param input Вектор входных данных
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const Vector& input) const
+    {
+        Vector output = input;
+        for (std::size_t layer = 0; layer < m_weights.size(); layer++) {
+            output = Forward(output, layer);
+        }
+        return output;
+    }
+private:
+    // Массив с разреженными матрицами весов каждого слоя
+    std::vector<SparseMatrix> m_weights;
+    // Массив с конфигурациями слоёв
+    std::vector<LayerConfig> m_layers;
+    // Массив с формами входов слоёв и формой выхода сети
+    std::vector<Shape> m_shapes;
+    // Точность вычисления функций активации
+    ActivationAccuracy m_accuracy;
+    // Объём памяти весов исходной нейронной сети
+    std::size_t m_denseSize;
+
+    /**
+     * Прямой проход по слою нейронной сети
+     *
+     * \param input Вектор входных данных
+     * \param layer Номер слоя
+     * \return Вектор выходных данных
+     */
+    Vector Forward(const Vector& input, const std::size_t layer) const
+    {
+        const auto& config = m_layers[layer];
+        Vector sums;
+        switch (config.type) {
+        case LayerType::Convolution:
+            {
+                // Свёртка - произведение разреженной матрицы фильтров на развёрнутый вход
+                const Matrix product = m_weights[layer] * Im2Col(input, m_shapes[layer], config.window, config.bias);
+                const std::size_t positions = product.Cols();
+                sums = Vector(m_shapes[layer + 1].Size());
+                for (std::size_t filter = 0; filter < product.Rows(); filter++) {
+                    std::copy(product[filter].Data(), product[filter].Data() + positions, sums.Data() + filter * positions);
+                }
+            }
+            break;
+        case LayerType::MaxPooling:
+            return MaxPool(input, m_shapes[layer], config.window);
+        default:
+            sums = m_weights[layer] * NeuralNetwork::VectorWithBias(input, config.bias);
+            break;
+        }
+        Vector result(sums.Size());
+        NN::Activate(config.fn, m_accuracy, sums.Data(), result.Data(), sums.Size());
+        return result;
+    }
+};
+
+}
@@ -0,0 +1,191 @@
+﻿#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <thread>
+
+#include "RingBuffer.hpp"
+
+namespace NN
+{
+
+/**
+ * Запись телеметрии об одном шаге обучения.
+ */
+struct TelemetryRecord
+{
+    // Номер шага обучения
+    std::uint64_t epoch;
+    // Ошибка
+    double loss;
+    // Норма градиента по весам
+    double gradientNorm;
+    // Время шага обучения в секундах
+    double stepTime;
+};
+
+/**
+ * Формат вывода телеметрии.
+ */
+enum class TelemetryFormat
+{
+    Console,    // Текст для чтения человеком
+    Csv,        // CSV с заголовком
+    Json        // JSON-объект на строку (JSON Lines)
+};
+
+/**
+ * Класс, реализующий сбор телеметрии обучения.
+ * Обучатель добавляет записи в кольцевой буфер без блокировок,
+ * а фоновый поток извлекает их, форматирует и выводит в поток вывода.
+ * Добавление записи не зависит от скорости вывода: если буфер заполнен,
+ * запись отбрасывается и учитывается в счётчике отброшенных записей.
+ */
+class Telemetry
+{
+public:
+    /**
+     * Конструктор. Запускает фоновый поток вывода.
+     *
+     * \param out Поток вывода
+     * \param format Формат вывода
+     * \param interval Выводятся записи шагов с номером, кратным interval
+     * \param capacity Ёмкость буфера записей
+     */
+    Telemetry(
+        std::ostream& out,
+        const TelemetryFormat format,
+        const std::size_t interval = 1,
+        const std::size_t capacity = 1 << 14):
+        m_out(out),
+        m_format(format),
+        m_interval(interval == 0 ? 1 : interval),
+        m_records(capacity),
+        m_dropped(0),
+        m_stop(false)
+    {
+        m_consumer = std::thread(&Telemetry::Consume, this);
+    }
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator = (const Telemetry&) = delete;
+    /**
+     * Деструктор. Выводит оставшиеся записи и останавливает фоновый поток.
+     */
+    ~Telemetry()
+    {
+        m_stop.store(true, std::memory_order_release);
+        m_consumer.join();
+    }
+    /**
+     * Добавление записи. Должно вызываться из одного потока.
+     *
+     * \param record Запись
+     */
+    void Push(const TelemetryRecord& record)
+    {
+        if (!m_records.TryPush(record)) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    /**
+     * Получение количества отброшенных записей.
+     *
+     * \return Количество записей, не поместившихся в буфер
+     */
+    std::uint64_t Dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+private:
+    // Поток вывода
+    std::ostream& m_out;
+    // Формат вывода
+    TelemetryFormat m_format;
+    // Интервал вывода записей
+    std::size_t m_interval;
+    // Буфер записей
+    RingBuffer<TelemetryRecord> m_records;
+    // Количество отброшенных записей
+    std::atomic<std::uint64_t> m_dropped;
+    // Признак остановки фонового потока
+    std::atomic<bool> m_stop;
+    // Фоновый поток вывода
+    std::thread m_consumer;
+
+    /**
+     * Извлечение и вывод записей в фоновом потоке.
+     */
+    void Consume()
+    {
+        if (m_format == TelemetryFormat::Csv) {
+            m_out << "epoch,loss,gradient_norm,step_time_us\n";
+        }
+        TelemetryRecord record;
+        for (;;) {
+            // Признак остановки читаем до извлечения, чтобы после остановки
+            // вывести все записи, добавленные до неё
+            const bool stop = m_stop.load(std::memory_order_acquire);
+            bool any = false;
+            while (m_records.TryPop(record)) {
+                any = true;
+                // Отбор по номеру шага не зависит от отброшенных записей
+                if (record.epoch % m_interval == 0) {
+                    Write(record);
+                }
+            }
+            if (stop) {
+                break;
+            }
+            if (!any) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        m_out.flush();
+    }
+
+    void Write(const TelemetryRecord& record)
+    {
+        const double stepTime = record.stepTime * 1e6;
+        switch (m_format) {
+        case TelemetryFormat::Console:
+            m_out << "Epoch: " << record.epoch
+                  << ", Error: " << record.loss
+                  << ", Gradient norm: " << record.gradientNorm
+                  << ", Step: " << stepTime << " us\n";
+            break;
+        case TelemetryFormat::Csv:
+            m_out << record.epoch << ',' << record.loss << ','
+                  << record.gradientNorm << ',' << stepTime << '\n';
+            break;
+        case TelemetryFormat::Json:
+            m_out << "{\"epoch\":" << record.epoch << ",\"loss\":";
+            WriteJsonNumber(record.loss);
+            m_out << ",\"gradient_norm\":";
+            WriteJsonNumber(record.gradientNorm);
+            m_out << ",\"step_time_us\":";
+            WriteJsonNumber(stepTime);
+            m_out << "}\n";
+            break;
+        }
+    }
+
+    /**
+     * Вывод числа в JSON. В JSON нет значений nan и inf, вместо них выводится null.
+     *
+     * \param value Число
+     */
+    void WriteJsonNumber(const double value)
+    {
+        if (std::isfinite(value)) {
+            m_out << value;
+        }
+        else {
+            m_out << "null";
+        }
+    }
+};
+
+}
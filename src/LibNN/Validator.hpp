@@ -0,0 +1,305 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "NeuralNetwork.hpp"
+#include "LossFunctions.hpp"
+#include "ModelPublisher.hpp"
+
+namespace NN
+{
+
+/**
+ * Структура, описывающая результат проверки версии нейронной сети.
+ */
+struct ValidationResult
+{
+    // Номер версии
+    std::size_t version;
+    // Номер шага обучения, на котором получена версия
+    std::uint64_t epoch;
+    // Ошибка на проверочных данных
+    double loss;
+    // Доля правильных ответов на проверочных данных
+    double accuracy;
+};
+
+/**
+ * Класс, реализующий проверку нейронной сети на отложенных данных
+ * в отдельном потоке во время обучения.
+ * Обучение периодически передаёт копию весов (Submit) и продолжается,
+ * не дожидаясь проверки. Поток проверки берёт последнюю опубликованную версию
+ * (промежуточные версии, не успевшие попасть на проверку, пропускаются),
+ * запоминает лучшую по ошибке версию и сообщает о ранней остановке,
+ * если ошибка не уменьшалась заданное количество проверок подряд.
+ */
+class Validator
+{
+public:
+    /**
+     * Конструктор. Запускает поток проверки.
+     *
+     * \param nn Нейронная сеть (начальная версия)
+     * \param inputs Массив векторов проверочных входных данных
+     * \param outputs Массив векторов желаемых выходных данных
+     * \param loss Функция потерь
+     * \param patience Количество проверок без улучшения до ранней остановки
+     * \param minDelta Минимальное уменьшение ошибки, считающееся улучшением
+     */
+    Validator(
+        const NeuralNetwork& nn,
+        const std::vector<Vector>& inputs,
+        const std::vector<Vector>& outputs,
+        const LossFunction loss = LossFunction::MeanSquaredError,
+        const std::size_t patience = 10,
+        const double minDelta = 0.0) noexcept(false):
+        m_inputs(inputs),
+        m_outputs(outputs),
+        m_loss(loss),
+        m_patience(patience),
+        m_minDelta(minDelta),
+        m_publisher(nn, 1),
+        m_best(nn),
+        m_bestResult{ 0, 0, std::numeric_limits<double>::infinity(), 0.0 },
+        m_lastResult(m_bestResult),
+        m_epochs{ { 1, 0 } },
+        m_evaluated(0),
+        m_stale(0),
+        m_shouldStop(false),
+        m_stop(false)
+    {
+        if (inputs.empty() || inputs.size() != outputs.size()) {
+            throw std::invalid_argument("Validation set must be non-empty and have equal number of inputs and outputs");
+        }
+        // Ошибки размеров проверяем здесь, в потоке проверки их некому обработать
+        for (std::size_t i = 0; i < inputs.size(); i++) {
+            if (inputs[i].Size() != nn.LayerShape(0).Size() || outputs[i].Size() != nn.LayerShape(nn.LayersCount()).Size()) {
+                throw std::out_of_range("Validation vectors must match network inputs and outputs");
+            }
+        }
+        if (loss == LossFunction::CrossEntropy && !SupportsCrossEntropy(nn.m_layers.back().fn)) {
+            throw std::invalid_argument("Cross-entropy requires softmax or sigmoid output layer");
+        }
+        m_thread = std::thread(&Validator::Run, this);
+    }
+    Validator(const Validator&) = delete;
+    Validator& operator = (const Validator&) = delete;
+    /**
+     * Деструктор. Останавливает поток проверки, не дожидаясь проверки последних версий.
+     */
+    ~Validator()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_condition.notify_all();
+        m_thread.join();
+    }
+    /**
+     * Передача версии нейронной сети на проверку.
+     * Копирует веса и сразу возвращает управление.
+     *
+     * \param nn Нейронная сеть
+     * \param epoch Номер шага обучения
+     */
+    void Submit(const NeuralNetwork& nn, const std::uint64_t epoch)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_epochs[m_publisher.Publish(nn)] = epoch;
+        }
+        m_condition.notify_all();
+    }
+    /**
+     * Ожидание проверки последней переданной версии.
+     */
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_evaluated == m_publisher.Version(); });
+    }
+    /**
+     * Проверка необходимости ранней остановки обучения.
+     *
+     * \return true, если ошибка на проверочных данных перестала уменьшаться
+     */
+    bool ShouldStop() const
+    {
+        return m_shouldStop.load(std::memory_order_acquire);
+    }
+    /**
+     * Получение результата проверки лучшей версии.
+     *
+     * \return Результат проверки
+     */
+    ValidationResult Best() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_bestResult;
+    }
+    /**
+     * Получение результата проверки последней проверенной версии.
+     *
+     * \return Результат проверки
+     */
+    ValidationResult Last() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lastResult;
+    }
+    /**
+     * Получение лучшей версии нейронной сети.
+     *
+     * \return Копия нейронной сети
+     */
+    NeuralNetwork BestModel() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_best;
+    }
+private:
+    // Проверочные входные данные
+    std::vector<Vector> m_inputs;
+    // Проверочные выходные данные
+    std::vector<Vector> m_outputs;
+    // Функция потерь
+    LossFunction m_loss;
+    // Количество проверок без улучшения до ранней остановки
+    std::size_t m_patience;
+    // Минимальное уменьшение ошибки
+    double m_minDelta;
+    // Версии нейронной сети, переданные на проверку
+    ModelPublisher m_publisher;
+    // Лучшая версия
+    NeuralNetwork m_best;
+    // Результат проверки лучшей версии
+    ValidationResult m_bestResult;
+    // Результат проверки последней версии
+    ValidationResult m_lastResult;
+    // Номера шагов обучения непроверенных версий
+    std::map<std::size_t, std::uint64_t> m_epochs;
+    // Номер последней проверенной версии
+    std::size_t m_evaluated;
+    // Количество проверок подряд без улучшения
+    std::size_t m_stale;
+    // Признак ранней остановки
+    std::atomic<bool> m_shouldStop;
+    // Признак остановки потока проверки
+    bool m_stop;
+    // Мьютекс результатов и ожидания новых версий
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    // Поток проверки
+    std::thread m_thread;
+
+    /**
+     * Цикл потока проверки.
+     */
+    void Run()
+    {
+        auto reader = m_publisher.RegisterReader();
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this]() { return m_stop || m_evaluated != m_publisher.Version(); });
+                if (m_stop) {
+                    break;
+                }
+            }
+            // Проверка выполняется без блокировок, обучение в это время продолжается
+            auto snapshot = reader.Acquire();
+            ValidationResult result = Evaluate(snapshot->network);
+            result.version = snapshot->version;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                // Номера шагов этой и пропущенных версий больше не нужны
+                auto it = m_epochs.upper_bound(result.version);
+                result.epoch = std::prev(it)->second;
+                m_epochs.erase(m_epochs.begin(), it);
+                m_lastResult = result;
+                if (result.loss < m_bestResult.loss - m_minDelta) {
+                    m_bestResult = result;
+                    m_best = snapshot->network;
+                    m_stale = 0;
+                }
+                else if (++m_stale >= m_patience) {
+                    m_shouldStop.store(true, std::memory_order_release);
+                }
+                m_evaluated = result.version;
+            }
+            m_condition.notify_all();
+        }
+    }
+
+    /**
+     * Вычисление ошибки и доли правильных ответов.
+     * Ответ считается правильным, если номер наибольшего выхода совпадает
+     * с номером наибольшего желаемого выхода; для сети с одним выходом -
+     * если выход и желаемый выход по одну сторону от 0.5.
+     *
+     * \param nn Нейронная сеть
+     * \return Результат проверки
+     */
+    ValidationResult Evaluate(const NeuralNetwork& nn) const
+    {
+        const ActivationFunction fn = nn.m_layers.back().fn;
+        double loss = 0.0;
+        std::size_t correct = 0;
+        for (std::size_t i = 0; i < m_inputs.size(); i++) {
+            const Vector output = nn.Forward(m_inputs[i]);
+            const Vector& target = m_outputs[i];
+            loss += Loss(fn, output, target);
+            if (output.Size() == 1) {
+                correct += (output[0] > 0.5) == (target[0] > 0.5) ? 1 : 0;
+            }
+            else {
+                const auto predicted = std::max_element(output.Data(), output.Data() + output.Size()) - output.Data();
+                const auto expected = std::max_element(target.Data(), target.Data() + target.Size()) - target.Data();
+                correct += predicted == expected ? 1 : 0;
+            }
+        }
+        return { 0, 0, loss / m_inputs.size(), static_cast<double>(correct) / m_inputs.size() };
+    }
+
+    /**
+     * Вычисление ошибки на одном примере по выходу сети.
+     * Совпадает с ошибкой, которую возвращает NeuralNetworkTrainer::Train.
+     */
+    double Loss(const ActivationFunction fn, const Vector& output, const Vector& target) const
+    {
+        // Ограничение снизу, чтобы логарифм нулевой вероятности был конечным
+        const double minProbability = 1e-300;
+        double loss = 0.0;
+        if (m_loss == LossFunction::CrossEntropy && fn == ActivationFunction::Softmax) {
+            for (std::size_t i = 0; i < output.Size(); i++) {
+                loss -= target[i] * std::log(std::max(output[i], minProbability));
+            }
+            return loss;
+        }
+        if (m_loss == LossFunction::CrossEntropy) {
+            // Бинарная перекрёстная энтропия суммируется по выходам
+            for (std::size_t i = 0; i < output.Size(); i++) {
+                loss -= target[i] * std::log(std::max(output[i], minProbability))
+                    + (1.0 - target[i]) * std::log(std::max(1.0 - output[i], minProbability));
+            }
+            return loss;
+        }
+        for (std::size_t i = 0; i < output.Size(); i++) {
+            loss += (output[i] - target[i]) * (output[i] - target[i]);
+        }
+        return loss / output.Size();
+    }
+};
+
+}
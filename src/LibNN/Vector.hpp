@@ -68,6 +68,24 @@ public:
     {
         return m_vector.size();
     }
+    /**
+     * Получение указателя на элементы вектора.
+     *
+     * \return Константный указатель на первый элемент
+     */
+    const double* Data() const noexcept
+    {
+        return m_vector.data();
+    }
+    /**
+     * Получение указателя на элементы вектора.
+     *
+     * \return Указатель на первый элемент
+     */
+    double* Data() noexcept
+    {
+        return m_vector.data();
+    }
     /**
      * Скалярное произведение векторов.
      * Пример: